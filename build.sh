@@ -7,7 +7,8 @@ LIB_PATHS="-L./bin"
 INCLUDES="-I./deps/stb -I./deps/tsoding -I./deps/QuelSolaar -I./deps/raylib/src -I./deps/raygui/src"
 RAYLIB_DEP="-lraylib -lm"
 RAYGUI_DEP="-lraygui"
-DEPS="$INCLUDES $LIB_PATHS $RAYLIB_DEP $RAYGUI_DEP"
+THREAD_DEP="-lpthread"
+DEPS="$INCLUDES $LIB_PATHS $RAYLIB_DEP $RAYGUI_DEP $THREAD_DEP"
 
 if [[ $1 -eq "a" ]] || [ -d "./bin" ]; then
 	# Remove old bin folder
@@ -6,23 +6,53 @@
 #include "sv.h"
 #include "stb_ds.h"
 
+// Memory outside of a gathering buffer, that is part of its content (see buf_writeRef)
+typedef struct {
+	u64         at;   // Index into the buffer's data, that the memory comes before
+	const void *data;
+	u64         size;
+} Buffer_Ref;
+
 typedef struct {
 	u8 *data;
 	u64 idx;
 	u64 size;
 	u64 cap;
+	Buffer_Ref *refs;      // stb_ds array. Only used by gathering buffers (see buf_newGather)
+	u64         refs_size; // Total size of refs in bytes
+	bool        gather;
 } Buffer;
 
+// Pieces of memory, that are written by buf_writeRef, are copied if they are smaller than this
+// Below that size, copying them is cheaper than passing them to writev on their own
+#define BUF_REF_MIN 256
+
 // @TODO: Add overflow checks when reading/peeking
 
+// Reads a file through a window of bounded size instead of reading all of it into memory at once
+// buf_fillStream moves the window to the requested range of the file, so that it can be read via `buf`
+typedef struct {
+	Buffer buf;       // Window into the file. buf.data[0] is the byte at offset `off` in the file
+	int    fd;
+	u64    off;       // Offset of the window in the file
+	u64    window;    // Size of the window. It only grows beyond that for ranges that don't fit into it
+	u64    file_size;
+} Buffer_Stream;
+
 #define buf_iter_cond(buf) ((buf).idx < (buf).size)
 
 Buffer buf_fromFile(const char *filename);
+bool buf_openStream(Buffer_Stream *stream, const char *filename, u64 window);
+bool buf_fillStream(Buffer_Stream *stream, u64 off, u64 size);
+void buf_closeStream(Buffer_Stream *stream);
 bool buf_copyToFile(Buffer buf, const char *filename);
 bool buf_toFile(Buffer *buf, const char *filename);
 Buffer buf_new(u64 initial_cap);
+Buffer buf_newGather(u64 initial_cap);
 void buf_ensure_size(Buffer *buf, u64 n);
 void buf_free(Buffer buf);
+u64  buf_len(Buffer buf);
+u32  buf_crc32c(u32 crc, const Buffer *buf, u64 off);
 u8  buf_read1(Buffer *buf);
 u16 buf_read2(Buffer *buf);
 u32 buf_read4(Buffer *buf);
@@ -41,9 +71,24 @@ void buf_write4i(Buffer *buf,i32 elem);
 void buf_write8i(Buffer *buf,i64 elem);
 String_View buf_peekSV(Buffer buf);
 String_View buf_readSV(Buffer *buf);
+String_View buf_peekSVRef(Buffer buf);
+String_View buf_readSVRef(Buffer *buf);
 void buf_writeStr(Buffer *buf, char *data, u64 size);
-Column buf_readColumn(Buffer *buf);
-void buf_writeColumn(Buffer *buf, Column elem);
+void buf_writeBytes(Buffer *buf, const void *data, u64 size);
+void buf_readArray(Buffer *buf, void *dst, u64 elem_size, u64 len);
+void buf_writeArray(Buffer *buf, const void *src, u64 elem_size, u64 len);
+void buf_writeRef(Buffer *buf, const void *data, u64 size);
+void buf_writeBuffer(Buffer *dst, const Buffer *src);
+u64  buf_readVarint(Buffer *buf);
+void buf_writeVarint(Buffer *buf, u64 elem);
+String_View buf_readVarSV(Buffer *buf);
+void buf_writeVarStr(Buffer *buf, char *data, u64 size);
+void buf_readGroupVarints(Buffer *buf, u32 *dst, u64 len);
+void buf_writeGroupVarints(Buffer *buf, const u32 *src, u64 len);
+Column buf_readColumn(Buffer *buf, bool varints);
+void buf_writeColumn(Buffer *buf, Column elem, bool varints);
+Value buf_readValue(Buffer *buf, Datatype type);
+void buf_writeValue(Buffer *buf, Datatype type, Value elem);
 
 #endif // BUF_H_
 
@@ -58,16 +103,84 @@ Buffer buf_fromFile(const char *filename)
 	return buf;
 }
 
-inline bool buf_copyToFile(Buffer buf, const char *filename)
+bool buf_openStream(Buffer_Stream *stream, const char *filename, u64 window)
+{
+	*stream = (Buffer_Stream) { .fd = open(filename, O_RDONLY | O_BINARY, 0777), .window = window };
+	if (stream->fd == -1) return false;
+	struct stat sb;
+	if (fstat(stream->fd, &sb) == -1) {
+		close(stream->fd);
+		return false;
+	}
+	stream->file_size = sb.st_size;
+	return true;
+}
+
+// Makes the bytes [off, off + size) of the file available in stream->buf, with buf.idx pointing at off
+// The window is only refilled if the range isn't in it already. It is then filled with as much of the file as fits,
+// so that following small ranges can be read without refilling it again
+// Returns false if the range isn't inside the file or reading fails
+bool buf_fillStream(Buffer_Stream *stream, u64 off, u64 size)
+{
+	if (off > stream->file_size || size > stream->file_size - off) return false;
+	Buffer *buf = &stream->buf;
+	if (off >= stream->off && off + size <= stream->off + buf->size) {
+		buf->idx = off - stream->off;
+		return true;
+	}
+	u64 cap = MAX(size, stream->window);
+	if (buf->cap != cap) {
+		// Nothing in the window needs to be kept, so it isn't reallocated
+		free(buf->data);
+		buf->data = malloc(cap);
+		buf->cap  = cap;
+	}
+	u64 len = MIN(cap, stream->file_size - off);
+	stream->off = off;
+	buf->idx    = 0;
+	buf->size   = 0;
+	if (!util_readAt(stream->fd, off, buf->data, len)) return false;
+	buf->size = len;
+	return true;
+}
+
+void buf_closeStream(Buffer_Stream *stream)
+{
+	close(stream->fd);
+	free(stream->buf.data);
+	*stream = (Buffer_Stream) {0};
+}
+
+// Returns the content of the buffer as a list of slices in order, which alternate between its own data and its refs
+static util_Slice* buf__slices(const Buffer *buf)
 {
-	return util_writeFile(filename, (char*) buf.data, buf.size);
+	util_Slice *out = NULL;
+	u64 at = 0;
+	for (i64 i = 0; i < stbds_arrlen(buf->refs); i++) {
+		Buffer_Ref ref = buf->refs[i];
+		if (ref.at > at) stbds_arrput(out, ((util_Slice) { .data = &buf->data[at], .size = ref.at - at }));
+		stbds_arrput(out, ((util_Slice) { .data = ref.data, .size = ref.size }));
+		at = ref.at;
+	}
+	if (buf->size > at) stbds_arrput(out, ((util_Slice) { .data = &buf->data[at], .size = buf->size - at }));
+	return out;
+}
+
+// The content of gathering buffers is written straight from the referenced memory with a few writev calls (see buf_writeRef)
+bool buf_copyToFile(Buffer buf, const char *filename)
+{
+	if (stbds_arrlen(buf.refs) == 0) return util_writeFile(filename, (char*) buf.data, buf.size);
+	util_Slice *slices = buf__slices(&buf);
+	bool out = util_writeFileV(filename, slices, stbds_arrlen(slices));
+	stbds_arrfree(slices);
+	return out;
 }
 
 // Unlike copyToFile, this function frees the buffer after writing it to the file
 bool buf_toFile(Buffer *buf, const char *filename)
 {
-	bool out = util_writeFile(filename, (char*)(buf->data), buf->size);
-	free(buf->data);
+	bool out = buf_copyToFile(*buf, filename);
+	buf_free(*buf);
 	return out;
 }
 
@@ -82,6 +195,16 @@ Buffer buf_new(u64 initial_cap)
 	return buf;
 }
 
+// A gathering buffer only references large pieces of memory, that are written into it via buf_writeRef, instead of copying them
+// That memory must stay unchanged until the buffer was written (see buf_toFile) or freed
+// Gathering buffers can only be appended to. Bytes before the first ref may still be overwritten via `data`
+Buffer buf_newGather(u64 initial_cap)
+{
+	Buffer buf = buf_new(initial_cap);
+	buf.gather = true;
+	return buf;
+}
+
 // Ensures that there's enough capacity to write `n` more bytes into the buffer
 void buf_ensure_size(Buffer *buf, u64 n)
 {
@@ -89,17 +212,34 @@ void buf_ensure_size(Buffer *buf, u64 n)
 	if (UNLIKELY(min > buf->cap)) {
 		u64 new_cap = buf->cap * 2;
 		if (UNLIKELY(min > new_cap)) new_cap = min;
-		u8 *new_data = malloc(new_cap);
-		memcpy(new_data, buf->data, buf->size);
-		free(buf->data);
-		buf->data = new_data;
-		buf->cap = new_cap;
+		buf->data = realloc(buf->data, new_cap);
+		buf->cap  = new_cap;
 	}
 }
 
 inline void buf_free(Buffer buf)
 {
 	free(buf.data);
+	stbds_arrfree(buf.refs);
+}
+
+// Size of the buffer's content in bytes, including the memory it references
+inline u64 buf_len(Buffer buf)
+{
+	return buf.size + buf.refs_size;
+}
+
+// Continues the CRC-32C crc with the buffer's content from offset off on (counted like buf_len)
+u32 buf_crc32c(u32 crc, const Buffer *buf, u64 off)
+{
+	util_Slice *slices = buf__slices(buf);
+	for (i64 i = 0; i < stbds_arrlen(slices); i++) {
+		u64 skip = MIN(off, slices[i].size);
+		crc  = util_crc32c(crc, (const u8*) slices[i].data + skip, slices[i].size - skip);
+		off -= skip;
+	}
+	stbds_arrfree(slices);
+	return crc;
 }
 
 u8  buf_read1(Buffer *buf)
@@ -232,6 +372,21 @@ String_View buf_readSV(Buffer *buf)
 	return out;
 }
 
+// Unlike peekSV, the returned String_View points directly into the buffer instead of a copy
+// It is therefore only valid as long as the buffer's data is and it is not null-terminated
+String_View buf_peekSVRef(Buffer buf)
+{
+	u64 size = *((u64*)(&buf.data[buf.idx]));
+	return sv_from_parts((char*) &buf.data[buf.idx + sizeof(u64)], size);
+}
+
+String_View buf_readSVRef(Buffer *buf)
+{
+	String_View out = buf_peekSVRef(*buf);
+	buf->idx += sizeof(u64) + out.count;
+	return out;
+}
+
 void buf_writeStr(Buffer *buf, char *data, u64 size)
 {
 	buf_ensure_size(buf, size + 8);
@@ -241,11 +396,147 @@ void buf_writeStr(Buffer *buf, char *data, u64 size)
 	if (LIKELY(buf->idx > buf->size)) buf->size = buf->idx;
 }
 
-Column buf_readColumn(Buffer *buf)
+// Unlike writeStr, the size isn't written into the buffer
+void buf_writeBytes(Buffer *buf, const void *data, u64 size)
+{
+	buf_ensure_size(buf, size);
+	memcpy(&buf->data[buf->idx], data, size);
+	buf->idx += size;
+	if (LIKELY(buf->idx > buf->size)) buf->size = buf->idx;
+}
+
+// Reads len elements of elem_size bytes each into dst with a single copy
+// Only valid for elements, whose in-memory layout is the same as their layout in the buffer
+void buf_readArray(Buffer *buf, void *dst, u64 elem_size, u64 len)
+{
+	memcpy(dst, &buf->data[buf->idx], elem_size * len);
+	buf->idx += elem_size * len;
+}
+
+// Writes len elements of elem_size bytes each from src with a single copy
+void buf_writeArray(Buffer *buf, const void *src, u64 elem_size, u64 len)
+{
+	buf_writeBytes(buf, src, elem_size * len);
+}
+
+// Same as buf_writeBytes, except that gathering buffers only reference the memory (see buf_newGather)
+// Memory that directly follows the last referenced memory extends it, so writing adjacent pieces one by one costs no extra slices
+void buf_writeRef(Buffer *buf, const void *data, u64 size)
+{
+	Buffer_Ref *last = stbds_arrlen(buf->refs) > 0 ? &stbds_arrlast(buf->refs) : NULL;
+	if (buf->gather && last != NULL && last->at == buf->size && (const u8*) last->data + last->size == data) {
+		last->size += size;
+	} else if (buf->gather && size >= BUF_REF_MIN) {
+		stbds_arrput(buf->refs, ((Buffer_Ref) { .at = buf->size, .data = data, .size = size }));
+	} else {
+		buf_writeBytes(buf, data, size);
+		return;
+	}
+	buf->refs_size += size;
+}
+
+// Appends the content of src to dst. If dst is a gathering buffer, src's data is referenced instead of copied,
+// so src must neither be changed nor freed until dst was written
+void buf_writeBuffer(Buffer *dst, const Buffer *src)
+{
+	util_Slice *slices = buf__slices(src);
+	for (i64 i = 0; i < stbds_arrlen(slices); i++) buf_writeRef(dst, slices[i].data, slices[i].size);
+	stbds_arrfree(slices);
+}
+
+// Varints are stored in LEB128: 7 bits per byte starting with the lowest ones. The highest bit is set if more bytes follow
+u64 buf_readVarint(Buffer *buf)
+{
+	u64 out = 0;
+	for (u32 shift = 0; shift < 64; shift += 7) {
+		u8 byte = buf->data[buf->idx++];
+		out |= (u64)(byte & 0x7F) << shift;
+		if (LIKELY(!(byte & 0x80))) break;
+	}
+	return out;
+}
+
+void buf_writeVarint(Buffer *buf, u64 elem)
+{
+	buf_ensure_size(buf, 10);
+	while (elem >= 0x80) {
+		buf->data[buf->idx++] = (u8) elem | 0x80;
+		elem >>= 7;
+	}
+	buf->data[buf->idx++] = (u8) elem;
+	if (LIKELY(buf->idx > buf->size)) buf->size = buf->idx;
+}
+
+// Like readSV, but the length is stored as a varint
+String_View buf_readVarSV(Buffer *buf)
+{
+	u64   size = buf_readVarint(buf);
+	char *data = malloc(size + 1);
+	memcpy(data, &buf->data[buf->idx], size);
+	data[size] = 0;
+	buf->idx += size;
+	return sv_from_parts(data, size);
+}
+
+void buf_writeVarStr(Buffer *buf, char *data, u64 size)
+{
+	buf_writeVarint(buf, size);
+	buf_writeBytes(buf, data, size);
+}
+
+// Group varints store four u32 at a time: one byte with the length-1 of each value in two bits (lowest bits first),
+// followed by the values in 1 to 4 bytes each. Unlike LEB128, decoding doesn't branch on every byte
+// The last group is filled up with zeros and followed by 3 bytes of padding, so that every value can be loaded as a whole u32
+void buf_readGroupVarints(Buffer *buf, u32 *dst, u64 len)
+{
+	static const u32 masks[4] = { 0xFF, 0xFFFF, 0xFFFFFF, 0xFFFFFFFF };
+	const u8 *data = &buf->data[buf->idx];
+	u64 i = 0;
+	for (; i + 4 <= len; i += 4) {
+		u8 tag = *data++;
+		for (u32 k = 0; k < 4; k++) {
+			u32 n = (tag >> (2*k)) & 3;
+			dst[i + k] = *((const u32*) data) & masks[n];
+			data += n + 1;
+		}
+	}
+	if (i < len) {
+		u8 tag = *data++;
+		for (u32 k = 0; k < 4; k++) {
+			u32 n = (tag >> (2*k)) & 3;
+			if (i + k < len) dst[i + k] = *((const u32*) data) & masks[n];
+			data += n + 1;
+		}
+	}
+	buf->idx = data - buf->data + 3;
+}
+
+void buf_writeGroupVarints(Buffer *buf, const u32 *src, u64 len)
+{
+	buf_ensure_size(buf, (len + 3) / 4 * 17 + 3);
+	u8 *data = &buf->data[buf->idx];
+	for (u64 i = 0; i < len; i += 4) {
+		u8 *tag = data++;
+		*tag = 0;
+		for (u32 k = 0; k < 4; k++) {
+			u32 val = i + k < len ? src[i + k] : 0;
+			u32 n   = val < (1u << 8) ? 1 : val < (1u << 16) ? 2 : val < (1u << 24) ? 3 : 4;
+			*tag |= (n - 1) << (2*k);
+			memcpy(data, &val, n);
+			data += n;
+		}
+	}
+	memset(data, 0, 3);
+	buf->idx = data - buf->data + 3;
+	if (LIKELY(buf->idx > buf->size)) buf->size = buf->idx;
+}
+
+// If varints is true, the lengths of strings and the amount of options are stored as varints
+Column buf_readColumn(Buffer *buf, bool varints)
 {
 	Column col = {0};
 	col.type = buf_read1(buf);
-	col.name = buf_readSV(buf);
+	col.name = varints ? buf_readVarSV(buf) : buf_readSV(buf);
 
 	STATIC_ASSERT(TYPE_LEN == 4);
 	switch (col.type)
@@ -253,10 +544,10 @@ Column buf_readColumn(Buffer *buf)
 	case TYPE_SELECT:
 	case TYPE_TAG:
 		{
-		i32 amount = buf_read4i(buf);
-		stbds_arrsetcap(col.opts.strs, amount);
+		i32 amount = varints ? (i32) buf_readVarint(buf) : buf_read4i(buf);
+		stbds_arrsetlen(col.opts.strs, amount);
 		for (i32 i = 0; i < amount; i++) {
-			col.opts.strs[i] = buf_readSV(buf);
+			col.opts.strs[i] = varints ? buf_readVarSV(buf) : buf_readSV(buf);
 		}
 		}
 		break;
@@ -264,15 +555,16 @@ Column buf_readColumn(Buffer *buf)
 	case TYPE_DATE:
 		break;
 	default:
-		PANIC("Reading unexpected value '%d' for column type in buffer at index '%lld'", col.type, buf->idx-1);
+		PANIC("Reading unexpected value '%d' for column type in buffer at index '%lld'", col.type, (long long) (buf->idx-1));
 	}
 	return col;
 }
 
-void buf_writeColumn(Buffer *buf, Column elem)
+void buf_writeColumn(Buffer *buf, Column elem, bool varints)
 {
 	buf_write1(buf, elem.type);
-	buf_writeStr(buf, elem.name.data, elem.name.count);
+	if (varints) buf_writeVarStr(buf, elem.name.data, elem.name.count);
+	else buf_writeStr(buf, elem.name.data, elem.name.count);
 	STATIC_ASSERT(TYPE_LEN == 4);
 	switch (elem.type)
 	{
@@ -281,10 +573,12 @@ void buf_writeColumn(Buffer *buf, Column elem)
 		{
 		String_View *opts = elem.opts.strs;
 		i32 len = stbds_arrlen(opts);
-		buf_write4i(buf, len);
+		if (varints) buf_writeVarint(buf, len);
+		else buf_write4i(buf, len);
 		for (i32 i = 0; i < len; i++) {
 			String_View sv = opts[i];
-			buf_writeStr(buf, sv.data, sv.count);
+			if (varints) buf_writeVarStr(buf, sv.data, sv.count);
+			else buf_writeStr(buf, sv.data, sv.count);
 		}
 		}
 		break;
@@ -295,5 +589,68 @@ void buf_writeColumn(Buffer *buf, Column elem)
 	// if (LIKELY(buf->idx > buf->size)) buf->size = buf->idx;
 }
 
+// Strings point into the buffer (see buf_readSVRef), Tags are newly allocated
+Value buf_readValue(Buffer *buf, Datatype type)
+{
+	Value val = {0};
+	STATIC_ASSERT(TYPE_LEN == 4);
+	switch (type)
+	{
+	case TYPE_STR:
+		val.str = buf_readSVRef(buf);
+		break;
+	case TYPE_SELECT:
+		val.select = buf_read4i(buf);
+		break;
+	case TYPE_TAG:
+		{
+		i32 amount = buf_read4i(buf);
+		stbds_arrsetlen(val.tag, amount);
+		for (i32 i = 0; i < amount; i++) {
+			val.tag[i] = buf_read4(buf);
+		}
+		}
+		break;
+	case TYPE_DATE:
+		val.date.day   = buf_read1(buf);
+		val.date.month = buf_read1(buf);
+		val.date.year  = buf_read2i(buf);
+		break;
+	default:
+		PANIC("Reading value of unexpected type '%d' in buffer at index '%lld'", type, (long long) buf->idx);
+	}
+	return val;
+}
+
+void buf_writeValue(Buffer *buf, Datatype type, Value elem)
+{
+	STATIC_ASSERT(TYPE_LEN == 4);
+	switch (type)
+	{
+	case TYPE_STR:
+		buf_writeStr(buf, elem.str.data, elem.str.count);
+		break;
+	case TYPE_SELECT:
+		buf_write4i(buf, elem.select);
+		break;
+	case TYPE_TAG:
+		{
+		i32 amount = stbds_arrlen(elem.tag);
+		buf_write4i(buf, amount);
+		for (i32 i = 0; i < amount; i++) {
+			buf_write4(buf, elem.tag[i]);
+		}
+		}
+		break;
+	case TYPE_DATE:
+		buf_write1(buf, elem.date.day);
+		buf_write1(buf, elem.date.month);
+		buf_write2i(buf, elem.date.year);
+		break;
+	default:
+		PANIC("Writing value of unexpected type '%d' into buffer", type);
+	}
+}
+
 
 #endif // BUF_IMPLEMENTATION
\ No newline at end of file
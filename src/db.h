@@ -0,0 +1,425 @@
+// Single-file container, that stores named blobs in fixed-size pages
+// Each blob occupies a contiguous run of pages, so it can be used straight from a mapping of the container
+//
+// Changes are never written over pages, that the last commit references. db_put writes the new content into free pages
+// and db_commit then writes the directory (entries and free-space map) into free pages as well, before switching to it
+// by writing the header. A crash at any point therefore leaves the container as it was after the previous commit
+// and several blobs can be changed atomically by committing them together
+//
+// Format:
+// Page 0: two header slots (at offset 0 and DB_PAGE_SIZE/2), each: u32 magic, u32 version, u64 seq, u64 dir_page, u64 dir_size, u32 crc32c
+//         Commits alternate between the slots and the valid slot with the highest seq is used
+// Directory: u64 pages, u64 entries_len, entries_len * (String name, u64 page, u64 size), free-space map (one bit per page, set if used),
+//            u32 crc32c of the directory before it (since version 2)
+
+#ifndef DB_H_
+#define DB_H_
+
+#include "util.h"
+#include "buf.h"
+#include "sv.h"
+#include "stb_ds.h"
+
+#define DB_PAGE_SIZE 4096
+
+typedef struct {
+    String_View name; // Owned by the container
+    u64         page; // First page of the blob
+    u64         size; // Size of the blob in bytes
+} Db_Entry;
+
+typedef struct {
+    char       *path;
+    int         fd;
+    u64         pages;     // Amount of pages in the container
+    u64         seq;       // Sequence number of the last commit
+    u8         *used;      // Free-space map: one bit per page, set if the page is used
+    u64        *released;  // Pages that were freed since the last commit, which still refers to them
+    u64        *retired;   // Pages that were freed before the last commit. They are only reused once no mapping,
+                           // that db_get returned a pointer into, is older than them, as it might still point into them
+    u64        *retired_at; // Parallel to retired: seq of the commit that retired the page
+    Db_Entry   *entries;
+    Db_Entry    dir;       // Location of the directory written by the last commit
+    char      **maps;      // Mappings that db_get returned pointers into. Unmapped once all pointers were dropped (see db_drop)
+    u64        *map_sizes; // Parallel to maps
+    u32        *map_refs;  // Parallel to maps: amount of pointers into the mapping, that weren't dropped yet
+    u64        *map_seqs;  // Parallel to maps: seq when the mapping was made. Its pointers were returned since then
+    util_Mutex  mutex;     // All functions can be called from several threads at once
+} Db;
+
+bool  db_open(Db *db, const char *path);
+void  db_close(Db *db);
+bool  db_has(Db *db, String_View name);
+char* db_get(Db *db, String_View name, u64 *size);
+void  db_drop(Db *db, const char *data);
+bool  db_put(Db *db, String_View name, const void *data, u64 size);
+bool  db_remove(Db *db, String_View name);
+bool  db_rename(Db *db, String_View old_name, String_View new_name);
+bool  db_commit(Db *db);
+
+#endif // DB_H_
+
+
+#ifdef DB_IMPLEMENTATION
+#ifndef DB_IMPL_GUARD_
+#define DB_IMPL_GUARD_
+
+const u32 DB_MAGIC   = 0x42444C52; // "RLDB" in little endian
+const u32 DB_VERSION = 2;
+#define DB_SLOT_SIZE (2*sizeof(u32) + 3*sizeof(u64) + sizeof(u32))
+
+static inline u64 db__pagesFor(u64 size)
+{
+    return (size + DB_PAGE_SIZE - 1) / DB_PAGE_SIZE;
+}
+
+static inline bool db__isUsed(Db *db, u64 page)
+{
+    return (db->used[page / 8] >> (page % 8)) & 1;
+}
+
+static void db__setUsed(Db *db, u64 page, u64 count, bool used)
+{
+    while ((u64) stbds_arrlen(db->used) * 8 < page + count) stbds_arrput(db->used, 0);
+    for (u64 p = page; p < page + count; p++) {
+        if (used) db->used[p / 8] |= 1 << (p % 8);
+        else db->used[p / 8] &= ~(1 << (p % 8));
+    }
+}
+
+static i32 db__find(Db *db, String_View name)
+{
+    for (i32 i = 0; i < stbds_arrlen(db->entries); i++) {
+        if (sv_eq(db->entries[i].name, name)) return i;
+    }
+    return -1;
+}
+
+// Returns the first page of a run of `count` free pages, that are marked as used afterwards. The container grows if there is no such run
+static u64 db__alloc(Db *db, u64 count)
+{
+    u64 run = 0;
+    for (u64 p = 0; p < db->pages && count > 0; p++) {
+        run = db__isUsed(db, p) ? 0 : run + 1;
+        if (run == count) {
+            db__setUsed(db, p + 1 - count, count, true);
+            return p + 1 - count;
+        }
+    }
+    // Free pages at the end of the container are extended instead of leaving them unused
+    u64 start = db->pages - run;
+    db->pages = start + count;
+    db__setUsed(db, start, count, true);
+    return start;
+}
+
+// The pages stay marked as used until no mapping and no commit refers to them anymore (see Db.released and Db.retired)
+static void db__release(Db *db, u64 page, u64 size)
+{
+    for (u64 p = page; p < page + db__pagesFor(size); p++) stbds_arrput(db->released, p);
+}
+
+// Frees the retired pages, that no mapping might point into anymore
+// A page retired by the commit with sequence number seq was only part of the entries before it, so only mappings made before it can point into it
+static void db__reuseRetired(Db *db)
+{
+    u64 oldest = UINT64_MAX;
+    for (i32 i = 0; i < stbds_arrlen(db->maps); i++) oldest = MIN(oldest, db->map_seqs[i]);
+    i64 kept = 0;
+    for (i64 i = 0; i < stbds_arrlen(db->retired); i++) {
+        if (db->retired_at[i] <= oldest) {
+            db__setUsed(db, db->retired[i], 1, false);
+            continue;
+        }
+        db->retired[kept]    = db->retired[i];
+        db->retired_at[kept] = db->retired_at[i];
+        kept++;
+    }
+    stbds_arrsetlen(db->retired, kept);
+    stbds_arrsetlen(db->retired_at, kept);
+}
+
+static bool db__writeBlob(Db *db, const void *data, u64 size, u64 *page)
+{
+    *page = db__alloc(db, db__pagesFor(size));
+    return util_writeAt(db->fd, *page * DB_PAGE_SIZE, data, size);
+}
+
+// Creates the container if it doesn't exist yet
+bool db_open(Db *db, const char *path)
+{
+    *db = (Db) {0};
+    db->fd = open(path, O_RDWR | O_CREAT | O_BINARY, 0777);
+    if (db->fd == -1) return false;
+    db->path = util_memadd(path, strlen(path), "", 1);
+    util_initMutex(&db->mutex);
+
+    struct stat sb;
+    if (fstat(db->fd, &sb) == -1) goto fail;
+    if (sb.st_size == 0) {
+        // Page 0 is reserved for the header
+        db->pages = 1;
+        db__setUsed(db, 0, 1, true);
+        return db_commit(db);
+    }
+
+    u8 header[DB_PAGE_SIZE];
+    if (!util_readAt(db->fd, 0, header, DB_PAGE_SIZE)) goto fail;
+    bool found       = false;
+    u32  dir_version = 0;
+    for (u32 i = 0; i < 2; i++) {
+        Buffer slot = { .data = &header[i * DB_PAGE_SIZE/2], .size = DB_SLOT_SIZE, .cap = DB_SLOT_SIZE };
+        u32 crc = util_crc32c(0, slot.data, DB_SLOT_SIZE - sizeof(u32));
+        if (buf_read4(&slot) != DB_MAGIC) continue;
+        u32 version = buf_read4(&slot);
+        u64 seq     = buf_read8(&slot);
+        u64 page    = buf_read8(&slot);
+        u64 size    = buf_read8(&slot);
+        if (buf_read4(&slot) != crc || version > DB_VERSION) continue;
+        if (found && seq <= db->seq) continue;
+        found       = true;
+        dir_version = version;
+        db->seq     = seq;
+        db->dir     = (Db_Entry) { .page = page, .size = size };
+    }
+    if (UNLIKELY(!found)) goto fail;
+
+    // The sizes in the directory are checked against its size before anything is read with them
+    u64 crc_size = dir_version >= 2 ? sizeof(u32) : 0;
+    if (UNLIKELY(db->dir.size < 2*sizeof(u64) + crc_size)) goto fail;
+    Buffer dir = buf_new(db->dir.size);
+    dir.size = db->dir.size;
+    if (!util_readAt(db->fd, db->dir.page * DB_PAGE_SIZE, dir.data, dir.size)) goto dir_fail;
+    u64 end = dir.size - crc_size;
+    if (crc_size > 0 && UNLIKELY(*((u32*) &dir.data[end]) != util_crc32c(0, dir.data, end))) goto dir_fail;
+    db->pages = buf_read8(&dir);
+    u64 entries_len = buf_read8(&dir);
+    if (UNLIKELY(entries_len > (end - dir.idx) / (3*sizeof(u64)))) goto dir_fail;
+    for (u64 i = 0; i < entries_len; i++) {
+        if (UNLIKELY(end - dir.idx < 3*sizeof(u64) || *((u64*) &dir.data[dir.idx]) > end - dir.idx - 3*sizeof(u64))) goto dir_fail;
+        Db_Entry entry;
+        entry.name = buf_readSV(&dir);
+        entry.page = buf_read8(&dir);
+        entry.size = buf_read8(&dir);
+        stbds_arrput(db->entries, entry);
+        if (UNLIKELY(entry.page > db->pages || db__pagesFor(entry.size) > db->pages - entry.page)) goto dir_fail;
+    }
+    u64 used_len = (db->pages + 7) / 8;
+    if (UNLIKELY(used_len > end - dir.idx)) goto dir_fail;
+    memcpy(stbds_arraddnptr(db->used, used_len), &dir.data[dir.idx], used_len);
+    buf_free(dir);
+    return true;
+
+dir_fail:
+    buf_free(dir);
+fail:
+    db_close(db);
+    return false;
+}
+
+void db_close(Db *db)
+{
+    for (i32 i = 0; i < stbds_arrlen(db->maps); i++) util_unmapFile(db->maps[i], db->map_sizes[i]);
+    for (i32 i = 0; i < stbds_arrlen(db->entries); i++) free(db->entries[i].name.data);
+    stbds_arrfree(db->maps);
+    stbds_arrfree(db->map_sizes);
+    stbds_arrfree(db->map_refs);
+    stbds_arrfree(db->map_seqs);
+    stbds_arrfree(db->entries);
+    stbds_arrfree(db->used);
+    stbds_arrfree(db->released);
+    stbds_arrfree(db->retired);
+    stbds_arrfree(db->retired_at);
+    if (db->fd != -1) close(db->fd);
+    free(db->path);
+    *db = (Db) { .fd = -1 };
+}
+
+bool db_has(Db *db, String_View name)
+{
+    util_lockMutex(&db->mutex);
+    bool out = db__find(db, name) >= 0;
+    util_unlockMutex(&db->mutex);
+    return out;
+}
+
+// Returns a pointer to the blob's content in a read-only mapping of the container, that stays valid until it is passed to db_drop
+// Returns NULL if there is no such blob (or it is empty)
+char* db_get(Db *db, String_View name, u64 *size)
+{
+    char *out = NULL;
+    *size = 0;
+    util_lockMutex(&db->mutex);
+    i32 idx = db__find(db, name);
+    if (idx < 0 || db->entries[idx].size == 0) goto end;
+    Db_Entry entry = db->entries[idx];
+    u64 end = entry.page * DB_PAGE_SIZE + entry.size;
+    // Blobs written after the last mapping was made need a new mapping. Old mappings are kept, as long as they are in use
+    i32 maps_len = stbds_arrlen(db->maps);
+    if (maps_len == 0 || db->map_sizes[maps_len - 1] < end) {
+        u64 map_size;
+        char *map = util_mapFile(db->path, &map_size);
+        if (map == NULL) goto end;
+        if (UNLIKELY(map_size < end)) {
+            util_unmapFile(map, map_size);
+            goto end;
+        }
+        stbds_arrput(db->maps, map);
+        stbds_arrput(db->map_sizes, map_size);
+        stbds_arrput(db->map_refs, 0);
+        stbds_arrput(db->map_seqs, db->seq);
+        maps_len += 1;
+    }
+    db->map_refs[maps_len - 1] += 1;
+    out   = &db->maps[maps_len - 1][entry.page * DB_PAGE_SIZE];
+    *size = entry.size;
+end:
+    util_unlockMutex(&db->mutex);
+    return out;
+}
+
+// Tells the container, that a pointer returned by db_get isn't used anymore. Does nothing if data is NULL
+// Mappings are unmapped once nothing points into them anymore, after which freed pages can be reused
+void db_drop(Db *db, const char *data)
+{
+    if (data == NULL) return;
+    util_lockMutex(&db->mutex);
+    for (i32 i = 0; i < stbds_arrlen(db->maps); i++) {
+        if (data < db->maps[i] || data >= db->maps[i] + db->map_sizes[i]) continue;
+        if (--db->map_refs[i] == 0) {
+            util_unmapFile(db->maps[i], db->map_sizes[i]);
+            stbds_arrdel(db->maps, i);
+            stbds_arrdel(db->map_sizes, i);
+            stbds_arrdel(db->map_refs, i);
+            stbds_arrdel(db->map_seqs, i);
+        }
+        break;
+    }
+    db__reuseRetired(db);
+    util_unlockMutex(&db->mutex);
+}
+
+// Replaces the blob's content (or adds the blob). Only takes effect for readers of the file once db_commit was called
+bool db_put(Db *db, String_View name, const void *data, u64 size)
+{
+    util_lockMutex(&db->mutex);
+    u64 page = 0;
+    bool out = size == 0 || db__writeBlob(db, data, size, &page);
+    if (out) {
+        i32 idx = db__find(db, name);
+        if (idx >= 0) {
+            db__release(db, db->entries[idx].page, db->entries[idx].size);
+            db->entries[idx].page = page;
+            db->entries[idx].size = size;
+        } else {
+            Db_Entry entry = { .name = sv_from_parts(util_memadd(name.data, name.count, "", 1), name.count), .page = page, .size = size };
+            stbds_arrput(db->entries, entry);
+        }
+    }
+    util_unlockMutex(&db->mutex);
+    return out;
+}
+
+bool db_remove(Db *db, String_View name)
+{
+    util_lockMutex(&db->mutex);
+    i32 idx = db__find(db, name);
+    if (idx >= 0) {
+        db__release(db, db->entries[idx].page, db->entries[idx].size);
+        free(db->entries[idx].name.data);
+        stbds_arrdel(db->entries, idx);
+    }
+    util_unlockMutex(&db->mutex);
+    return idx >= 0;
+}
+
+// Replaces a blob called new_name, if there is one
+bool db_rename(Db *db, String_View old_name, String_View new_name)
+{
+    util_lockMutex(&db->mutex);
+    i32 idx = db__find(db, old_name);
+    i32 dst = db__find(db, new_name);
+    if (idx >= 0 && dst >= 0 && dst != idx) {
+        db__release(db, db->entries[dst].page, db->entries[dst].size);
+        free(db->entries[dst].name.data);
+        stbds_arrdel(db->entries, dst);
+        if (dst < idx) idx -= 1;
+    }
+    if (idx >= 0) {
+        free(db->entries[idx].name.data);
+        db->entries[idx].name = sv_from_parts(util_memadd(new_name.data, new_name.count, "", 1), new_name.count);
+    }
+    util_unlockMutex(&db->mutex);
+    return idx >= 0;
+}
+
+// Makes all changes since the last commit visible at once
+bool db_commit(Db *db)
+{
+    util_lockMutex(&db->mutex);
+    i32 entries_len  = stbds_arrlen(db->entries);
+    u64 entries_size = 2*sizeof(u64);
+    for (i32 i = 0; i < entries_len; i++) entries_size += 3*sizeof(u64) + db->entries[i].name.count;
+    // The directory's own pages are allocated before the free-space map is written. They might grow the container and with it the map
+    u64 dir_pages = 1;
+    while (entries_size + (db->pages + dir_pages + 7) / 8 + sizeof(u32) > dir_pages * DB_PAGE_SIZE) dir_pages++;
+    u64 dir_page = db__alloc(db, dir_pages);
+
+    Buffer dir = buf_new(entries_size + (db->pages + 7) / 8 + sizeof(u32));
+    buf_write8(&dir, db->pages);
+    buf_write8(&dir, entries_len);
+    for (i32 i = 0; i < entries_len; i++) {
+        Db_Entry entry = db->entries[i];
+        buf_writeStr(&dir, entry.name.data, entry.name.count);
+        buf_write8(&dir, entry.page);
+        buf_write8(&dir, entry.size);
+    }
+    // Released and retired pages are stored as free, since no mapping refers to them anymore once the container is reopened
+    u64 used_len = (db->pages + 7) / 8;
+    u64 used_idx = dir.idx;
+    buf_writeBytes(&dir, db->used, used_len);
+    for (i32 i = 0; i < stbds_arrlen(db->released); i++) {
+        u64 p = db->released[i];
+        dir.data[used_idx + p / 8] &= ~(1 << (p % 8));
+    }
+    for (i32 i = 0; i < stbds_arrlen(db->retired); i++) {
+        u64 p = db->retired[i];
+        dir.data[used_idx + p / 8] &= ~(1 << (p % 8));
+    }
+    buf_write4(&dir, util_crc32c(0, dir.data, dir.size));
+
+    // The directory has to be on the disk before the header points to it
+    bool out = util_writeAt(db->fd, dir_page * DB_PAGE_SIZE, dir.data, dir.size) && util_syncFile(db->fd);
+    u64 size = dir.size;
+    buf_free(dir);
+    if (out) {
+        Buffer slot = buf_new(DB_SLOT_SIZE);
+        buf_write4(&slot, DB_MAGIC);
+        buf_write4(&slot, DB_VERSION);
+        buf_write8(&slot, db->seq + 1);
+        buf_write8(&slot, dir_page);
+        buf_write8(&slot, size);
+        buf_write4(&slot, util_crc32c(0, slot.data, slot.size));
+        out = util_writeAt(db->fd, ((db->seq + 1) % 2) * DB_PAGE_SIZE/2, slot.data, slot.size) && util_syncFile(db->fd);
+        buf_free(slot);
+    }
+    if (out) {
+        if (db->dir.size > 0) db__release(db, db->dir.page, db->dir.size);
+        db->dir = (Db_Entry) { .page = dir_page, .size = size };
+        db->seq += 1;
+        // No commit refers to the released pages anymore
+        for (i32 i = 0; i < stbds_arrlen(db->released); i++) {
+            stbds_arrput(db->retired, db->released[i]);
+            stbds_arrput(db->retired_at, db->seq);
+        }
+        stbds_arrsetlen(db->released, 0);
+        db__reuseRetired(db);
+    } else {
+        db__release(db, dir_page, dir_pages * DB_PAGE_SIZE);
+    }
+    util_unlockMutex(&db->mutex);
+    return out;
+}
+
+#endif // DB_IMPL_GUARD_
+#endif // DB_IMPLEMENTATION
@@ -0,0 +1,152 @@
+// Fast LZ77 compression of independent blocks, in the spirit of LZ4
+// Compression only finds matches via a small hash table of recent positions, so it runs at several hundred MB/s,
+// and decompression is little more than copying bytes around
+//
+// Format: a sequence of (token, literals, match) until the end of the input
+// token:    u8, upper 4 bits are the amount of literals, lower 4 bits the match length - LZ_MIN_MATCH
+//           A value of 15 in either means that the value continues in the following bytes: each byte is added and
+//           another one follows if it was 255 (for the match length after the offset)
+// literals: bytes copied as they are
+// match:    u16 offset back into the output, then the extension of the match length if needed
+//           The last sequence ends after its literals and has no match
+
+#ifndef LZ_H_
+#define LZ_H_
+
+#include "util.h"
+
+#define LZ_MIN_MATCH 4
+
+u64  lz_bound(u64 size);
+u64  lz_compress(const void *src, u64 size, void *dst);
+bool lz_decompress(const void *src, u64 size, void *dst, u64 raw_size);
+
+#endif // LZ_H_
+
+
+#ifdef LZ_IMPLEMENTATION
+#ifndef LZ_IMPL_GUARD_
+#define LZ_IMPL_GUARD_
+
+#define LZ_HASH_BITS  12
+#define LZ_MAX_OFFSET 0xFFFF
+
+static inline u32 lz__load4(const u8 *p)
+{
+    u32 out;
+    memcpy(&out, p, sizeof(u32));
+    return out;
+}
+
+static inline u32 lz__hash(u32 seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline u8* lz__writeLen(u8 *dst, u64 len)
+{
+    for (; len >= 255; len -= 255) *dst++ = 255;
+    *dst++ = (u8) len;
+    return dst;
+}
+
+static u8* lz__writeSequence(u8 *dst, const u8 *lits, u64 lits_len, u64 offset, u64 match_len, bool last)
+{
+    u8 *token = dst++;
+    *token = (u8) (MIN(lits_len, 15) << 4);
+    if (lits_len >= 15) dst = lz__writeLen(dst, lits_len - 15);
+    memcpy(dst, lits, lits_len);
+    dst += lits_len;
+    if (last) return dst;
+    u64 len = match_len - LZ_MIN_MATCH;
+    *token |= (u8) MIN(len, 15);
+    *dst++ = (u8) offset;
+    *dst++ = (u8) (offset >> 8);
+    if (len >= 15) dst = lz__writeLen(dst, len - 15);
+    return dst;
+}
+
+// Maximum size of the compressed data for an input of the given size
+u64 lz_bound(u64 size)
+{
+    return size + size / 255 + 16;
+}
+
+// Compresses size bytes from src into dst, which must have room for lz_bound(size) bytes
+// Returns the size of the compressed data. It might be larger than the input for incompressible data
+u64 lz_compress(const void *src, u64 size, void *dst)
+{
+    const u8 *in  = src;
+    u8       *out = dst;
+    u64 table[1 << LZ_HASH_BITS] = {0}; // Position + 1 of the last occurence of each hashed sequence
+    u64 anchor = 0;
+    u64 i      = 0;
+    while (i + LZ_MIN_MATCH <= size) {
+        u32 seq  = lz__load4(&in[i]);
+        u32 h    = lz__hash(seq);
+        u64 cand = table[h];
+        table[h] = i + 1;
+        if (cand == 0 || i - (cand - 1) > LZ_MAX_OFFSET || lz__load4(&in[cand - 1]) != seq) {
+            // Incompressible data is skipped faster the longer no match was found
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+        cand--;
+        u64 len = LZ_MIN_MATCH;
+        while (i + len < size && in[cand + len] == in[i + len]) len++;
+        out    = lz__writeSequence(out, &in[anchor], i - anchor, i - cand, len, false);
+        i     += len;
+        anchor = i;
+    }
+    out = lz__writeSequence(out, &in[anchor], size - anchor, 0, 0, true);
+    return out - (u8*) dst;
+}
+
+static inline bool lz__readLen(const u8 *src, u64 size, u64 *idx, u64 *len)
+{
+    u8 byte;
+    do {
+        if (UNLIKELY(*idx >= size)) return false;
+        byte  = src[(*idx)++];
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decompresses size bytes from src into dst, which must have room for raw_size bytes
+// Returns false if the data is malformed or doesn't decompress to exactly raw_size bytes. Never reads or writes out of bounds
+bool lz_decompress(const void *src, u64 size, void *dst, u64 raw_size)
+{
+    const u8 *in  = src;
+    u8       *out = dst;
+    u64 s = 0;
+    u64 d = 0;
+    while (s < size) {
+        u8  token = in[s++];
+        u64 lits  = token >> 4;
+        if (lits == 15 && !lz__readLen(in, size, &s, &lits)) return false;
+        if (UNLIKELY(lits > size - s || lits > raw_size - d)) return false;
+        memcpy(&out[d], &in[s], lits);
+        s += lits;
+        d += lits;
+        if (s == size) break;
+        if (UNLIKELY(size - s < 2)) return false;
+        u64 offset = in[s] | ((u64) in[s + 1] << 8);
+        s += 2;
+        u64 len = token & 15;
+        if (len == 15 && !lz__readLen(in, size, &s, &len)) return false;
+        len += LZ_MIN_MATCH;
+        if (UNLIKELY(offset == 0 || offset > d || len > raw_size - d)) return false;
+        if (offset >= len) {
+            memcpy(&out[d], &out[d - offset], len);
+        } else {
+            // The match overlaps with its own output, which repeats the last offset bytes
+            for (u64 k = 0; k < len; k++) out[d + k] = out[d + k - offset];
+        }
+        d += len;
+    }
+    return d == raw_size;
+}
+
+#endif // LZ_IMPL_GUARD_
+#endif // LZ_IMPLEMENTATION
@@ -7,9 +7,14 @@
 #include <stdio.h>     // For printf - only used for debugging
 #include <assert.h>    // For assert
 #include <string.h>    // For memcpy
+#include <time.h>      // For time
 #include "raylib.h"    // For immediate UI framework
 #include "raygui.h"
 
+#define DB_IMPLEMENTATION
+#include "db.h"        // Includes util.h, buf.h and sv.h before their implementations are requested below
+#define LZ_IMPLEMENTATION
+#include "lz.h"        // For compressing column chunks
 #define UTIL_IMPLEMENTATION
 #include "util.h"
 #define BUF_IMPLEMENTATION
@@ -23,299 +28,3262 @@
 #include "stb_ds.h"  // For dynamic arrays
 
 const char TD_FILENAME[] = "./tables.def";
+const char DB_FILENAME[] = "rl.db";
+const u32  TD_MAGIC      = 0x46444C52; // "RLDF" in little endian
+const u32  TD_VERSION    = 1;
+const u32  TAB_MAGIC     = 0x42544C52; // "RLTB" in little endian
+const u32  TAB_VERSION   = 13;
+const u64  TAB_HEADER_SIZE   = 2*sizeof(u32) + 2*sizeof(u64); // Size of the header of version 8 '.tab' files up to and including metasize
+const u64  TAB_STREAM_WINDOW = 256 * 1024; // Size of the window that unmapped '.tab' files are read through
+const u64  TAB_DIR_ENTRY_SIZE = 4*sizeof(u64) + 1 + sizeof(u32) + 3*sizeof(i32); // Size of the entry of a chunk in the column directory of '.tab' files
+const u64  TAB_HEAP_ENTRY_SIZE = 3*sizeof(u64) + sizeof(u32);    // Size of the description of the string heap in '.tab' files
+const Chunk_Stats CHUNK_STATS_ANY = { .mask = ~0ull, .min = INT32_MIN, .max = INT32_MAX }; // Statistics that never rule out a value
+#define WAL_CHECKPOINT_MIN_SIZE (256 * 1024) // The write-ahead log is never checkpointed before reaching this size
+#define STR_DICT_MAX_LEN        1024         // Maximum amount of distinct values in a dictionary-encoded TYPE_STR column
+#define STR_DICT_MIN_REPEATS    4            // A TYPE_STR column is only dictionary-encoded, if each value appears this often on average
+#define TAG_BITSET_MAX_OPTS     256          // TYPE_TAG columns with more options use the sparse representation
+#define STR_VARINT_MAX_AVG_LEN  32           // TYPE_STR columns with shorter values on average store their lengths as varints
+#define SELECT_RLE_RUN_SIZE     3            // Approximate size of a run in bytes, used to decide whether to run-length encode TYPE_SELECT columns
+#define SELECT_RLE_MAX_BITS     16           // TYPE_SELECT columns with wider values are never run-length encoded
+
+// Mutations are collected and appended to the write-ahead log together, once there are this many of them
+// or the oldest one waited this long. Can be overwritten when compiling
+#ifndef WAL_GROUP_MAX_RECORDS
+#define WAL_GROUP_MAX_RECORDS   64
+#endif
+#ifndef WAL_GROUP_MAX_DELAY_MS
+#define WAL_GROUP_MAX_DELAY_MS  250
+#endif
+
+#define TABLE_EVICT_AFTER_MS    (5 * 60 * 1000) // Tables that weren't accessed for this long are freed by evictTables
+
+// Large tables are split into row groups of this many rows, whose chunks are read, scanned and rewritten independently
+// Must be a multiple of 64, so that the packed values of each row group start at a word. Can be overwritten when compiling
+#ifndef TAB_GROUP_ROWS
+#define TAB_GROUP_ROWS (64 * 1024)
+#endif
+
+// When compiled with TAB_COMPRESS=1, column chunks of '.tab' files are compressed, if that makes them smaller
+// This trades CPU time for less I/O, but compressed columns can't be used straight from the mapped file
+#ifndef TAB_COMPRESS
+#define TAB_COMPRESS 0
+#endif
+
+// When compiled with TAB_STR_SLOTS=1, TYPE_STR columns that aren't dictionary-encoded are stored as slots into the string heap
+// Changed values can then be appended to the heap instead of rewriting the file (see patchTabFile),
+// but each value takes 12 bytes besides its content and the values can't be used straight from the mapped file
+#ifndef TAB_STR_SLOTS
+#define TAB_STR_SLOTS 0
+#endif
+
+// When compiled with TAB_SEGMENTS=1, the '.tab' file only contains the metadata and each chunk is stored in its own segment file
+// Checkpoints then only write the chunks that changed and the segment files are read in parallel, but never mapped
+// Tables in the container always store all columns in the '.tab' file
+#ifndef TAB_SEGMENTS
+#define TAB_SEGMENTS 0
+#endif
+
+// When compiled with USE_CONTAINER=1, new data is stored in a single container file (see useContainer)
+// Existing containers are always used
+#ifndef USE_CONTAINER
+#define USE_CONTAINER 0
+#endif
+
+// When compiled with PRELOAD_TABLES=1, all tables are read at startup (see loadAllTables) instead of on their first access
+#ifndef PRELOAD_TABLES
+#define PRELOAD_TABLES 0
+#endif
+
+static Db               *table_db          = NULL;  // Container, that tables.def and the '.tab' files are stored in. NULL if separate files are used
+static Checkpoint_Writer checkpoint_writer = {0};     // Started once the first checkpoint is queued
+static bool              def_file_dirty    = false; // Whether tables.def still has to be rewritten by flushPending
 
 
 ///////////////
 // Functions //
 ///////////////
 
-Table readTabFile(String_View tablename)
+i32 getTableRowsLen(Table table)
+{
+    return table.rows;
+}
+
+// Amount of strings stored in offs and bytes. Differs from len for dictionary-encoded columns
+static inline i32 getStrEntries(Str_Values vals)
+{
+    return vals.codes != NULL ? vals.dict_len : vals.len;
+}
+
+// The returned String_View points into the column and isn't null-terminated. Empty values have a NULL data pointer
+Value_Str getStr(Str_Values vals, i32 idx)
+{
+    if (vals.codes != NULL) idx = vals.codes[idx];
+    u64 start = vals.offs[idx];
+    u64 count = vals.offs[idx + 1] - start;
+    return sv_from_parts(count == 0 ? NULL : &vals.bytes[start], count);
+}
+
+// Copies values pointing into a mapped file onto the heap, so they can be changed
+void detachStrValues(Str_Values *vals)
+{
+    if (vals->owned) return;
+    i32 entries = getStrEntries(*vals);
+    u64 *offs   = NULL;
+    char *bytes = NULL;
+    u16 *codes  = NULL;
+    if (vals->offs != NULL) {
+        stbds_arrsetlen(offs,  entries + 1);
+        stbds_arrsetlen(bytes, vals->offs[entries]);
+        memcpy(offs,  vals->offs,  (entries + 1) * sizeof(u64));
+        memcpy(bytes, vals->bytes, vals->offs[entries]);
+    }
+    if (vals->codes != NULL) {
+        stbds_arrsetlen(codes, vals->len);
+        memcpy(codes, vals->codes, vals->len * sizeof(u16));
+    }
+    vals->offs  = offs;
+    vals->bytes = bytes;
+    vals->codes = codes;
+    vals->owned = true;
+}
+
+// Appends a string to offs and bytes without touching the codes
+static void appendStrEntry(Str_Values *vals, String_View sv)
+{
+    if (vals->offs == NULL) stbds_arrput(vals->offs, 0);
+    if (sv.count > 0) memcpy(stbds_arraddnptr(vals->bytes, sv.count), sv.data, sv.count);
+    stbds_arrput(vals->offs, stbds_arrlen(vals->bytes));
+}
+
+// Turns a dictionary-encoded column back into a plain one
+static void undictStrValues(Str_Values *vals)
+{
+    if (vals->codes == NULL) return;
+    detachStrValues(vals);
+    Str_Values plain = { .owned = true };
+    for (i32 i = 0; i < vals->len; i++) appendStrEntry(&plain, getStr(*vals, i));
+    plain.len = vals->len;
+    stbds_arrfree(vals->offs);
+    stbds_arrfree(vals->bytes);
+    stbds_arrfree(vals->codes);
+    *vals = plain;
+}
+
+// Returns the code of the string in the column's dictionary. New strings are added to the dictionary
+// Returns -1 if the dictionary is full, in which case the column should be undicted
+static i32 getStrCode(Str_Values *vals, String_View sv)
+{
+    for (i32 i = 0; i < vals->dict_len; i++) {
+        u64 start = vals->offs[i];
+        if (vals->offs[i + 1] - start == sv.count && memcmp(&vals->bytes[start], sv.data, sv.count) == 0) return i;
+    }
+    if (vals->dict_len >= STR_DICT_MAX_LEN) return -1;
+    appendStrEntry(vals, sv);
+    return vals->dict_len++;
+}
+
+void appendStr(Str_Values *vals, String_View sv)
+{
+    detachStrValues(vals);
+    if (vals->codes != NULL) {
+        i32 code = getStrCode(vals, sv);
+        if (code >= 0) {
+            stbds_arrput(vals->codes, code);
+            vals->len += 1;
+            return;
+        }
+        undictStrValues(vals);
+    }
+    appendStrEntry(vals, sv);
+    vals->len += 1;
+}
+
+// For plain columns, all values after idx are moved, so this takes time proportional to the column's size
+void setStr(Str_Values *vals, i32 idx, String_View sv)
+{
+    detachStrValues(vals);
+    if (vals->codes != NULL) {
+        i32 code = getStrCode(vals, sv);
+        if (code >= 0) {
+            vals->codes[idx] = code;
+            return;
+        }
+        undictStrValues(vals);
+    }
+    u64 start = vals->offs[idx];
+    u64 end   = vals->offs[idx + 1];
+    u64 total = vals->offs[vals->len];
+    i64 diff  = (i64) sv.count - (i64) (end - start);
+    if (diff > 0) stbds_arrsetlen(vals->bytes, total + diff);
+    memmove(&vals->bytes[end + diff], &vals->bytes[end], total - end);
+    if (diff < 0) stbds_arrsetlen(vals->bytes, total + diff);
+    memcpy(&vals->bytes[start], sv.data, sv.count);
+    for (i32 i = idx + 1; i <= vals->len; i++) vals->offs[i] += diff;
+}
+
+// Builds a dictionary-encoded copy of the column, if it has few enough distinct values to benefit from it
+// The dictionary only contains values that are actually used, even if `vals` was dictionary-encoded before
+static bool buildStrDict(Str_Values vals, Str_Values *out)
+{
+    if (vals.len < STR_DICT_MIN_REPEATS) return false;
+    // Open addressing hash table of code+1 for each distinct value (0 marks an empty slot). Its load factor is at most 0.5
+    const u32 slots_len = 2*STR_DICT_MAX_LEN;
+    u16 slots[2*STR_DICT_MAX_LEN] = {0};
+    Str_Values dict = { .owned = true };
+    bool ok = true;
+    for (i32 i = 0; i < vals.len && ok; i++) {
+        String_View sv = getStr(vals, i);
+        u32 slot = stbds_hash_bytes(sv.data, sv.count, 0) & (slots_len - 1);
+        while (slots[slot] != 0) {
+            String_View entry = getStr((Str_Values){ .offs = dict.offs, .bytes = dict.bytes }, slots[slot] - 1);
+            if (entry.count == sv.count && memcmp(entry.data, sv.data, sv.count) == 0) break;
+            slot = (slot + 1) & (slots_len - 1);
+        }
+        if (slots[slot] == 0) {
+            if (dict.dict_len >= STR_DICT_MAX_LEN || (dict.dict_len + 1) * STR_DICT_MIN_REPEATS > vals.len) {
+                ok = false;
+                break;
+            }
+            appendStrEntry(&dict, sv);
+            slots[slot] = ++dict.dict_len;
+        }
+        stbds_arrput(dict.codes, slots[slot] - 1);
+    }
+    if (!ok) {
+        stbds_arrfree(dict.offs);
+        stbds_arrfree(dict.bytes);
+        stbds_arrfree(dict.codes);
+        return false;
+    }
+    dict.len = vals.len;
+    *out = dict;
+    return true;
+}
+
+// Returns a list of the indexes of all rows whose value equals sv
+// On dictionary-encoded columns, sv is only compared against each distinct value once and the rows are compared by their codes
+u32* filterStrEq(Str_Values vals, String_View sv)
+{
+    u32 *rows = NULL;
+    if (vals.codes != NULL) {
+        i32 code = -1;
+        for (i32 i = 0; i < vals.dict_len && code < 0; i++) {
+            u64 start = vals.offs[i];
+            if (vals.offs[i + 1] - start == sv.count && memcmp(&vals.bytes[start], sv.data, sv.count) == 0) code = i;
+        }
+        if (code < 0) return NULL;
+        for (i32 i = 0; i < vals.len; i++) {
+            if (vals.codes[i] == code) stbds_arrput(rows, i);
+        }
+    } else {
+        for (i32 i = 0; i < vals.len; i++) {
+            String_View s = getStr(vals, i);
+            if (s.count == sv.count && memcmp(s.data, sv.data, sv.count) == 0) stbds_arrput(rows, i);
+        }
+    }
+    return rows;
+}
+
+// Returns the smallest amount of bits per value (a power of two), that can store values up to max
+u8 getSelectBits(u64 max)
+{
+    u8 bits = 1;
+    while (bits < 32 && (max >> bits) != 0) bits *= 2;
+    return bits;
+}
+
+Value_Select getSelect(Select_Values vals, i32 idx)
+{
+    u32 per_word = 64 / vals.bits;
+    u64 word     = vals.words[idx / per_word];
+    u32 shift    = (idx % per_word) * vals.bits;
+    return (Value_Select) ((word >> shift) & ((1ull << vals.bits) - 1)) - 1;
+}
+
+// Copies values pointing into a mapped file onto the heap, so they can be changed
+void detachSelectValues(Select_Values *vals)
+{
+    if (vals->owned) return;
+    u64 *words = NULL;
+    u32 words_len = (vals->len * vals->bits + 63) / 64;
+    stbds_arrsetlen(words, words_len);
+    memcpy(words, vals->words, words_len * sizeof(u64));
+    vals->words = words;
+    vals->owned = true;
+}
+
+// Repacks all values with a different amount of bits per value
+void resizeSelectValues(Select_Values *vals, u8 bits)
+{
+    u32 per_word  = 64 / bits;
+    u32 words_len = (vals->len + per_word - 1) / per_word;
+    u64 *words    = NULL;
+    stbds_arrsetlen(words, words_len);
+    memset(words, 0, words_len * sizeof(u64));
+    for (i32 i = 0; i < vals->len; i++) {
+        u64 stored = getSelect(*vals, i) + 1;
+        words[i / per_word] |= stored << ((i % per_word) * bits);
+    }
+    if (vals->owned) stbds_arrfree(vals->words);
+    vals->words = words;
+    vals->bits  = bits;
+    vals->owned = true;
+}
+
+void setSelect(Select_Values *vals, i32 idx, Value_Select val)
+{
+    u64 stored = val < 0 ? 0 : (u64) val + 1;
+    if (UNLIKELY((stored >> vals->bits) != 0)) resizeSelectValues(vals, getSelectBits(stored));
+    detachSelectValues(vals);
+    u32 per_word = 64 / vals->bits;
+    u32 shift    = (idx % per_word) * vals->bits;
+    u64 mask     = ((1ull << vals->bits) - 1) << shift;
+    u64 *word    = &vals->words[idx / per_word];
+    *word = (*word & ~mask) | (stored << shift);
+}
+
+void appendSelect(Select_Values *vals, Value_Select val)
+{
+    if (vals->bits == 0) vals->bits = 1;
+    detachSelectValues(vals);
+    if ((vals->len * vals->bits) % 64 == 0) stbds_arrput(vals->words, 0);
+    vals->len += 1;
+    setSelect(vals, vals->len - 1, val);
+}
+
+// Returns the amount of u64 words per value needed for a bitset of optslen options, or 0 if the sparse representation is needed
+u8 getTagWords(u64 optslen)
+{
+    if (optslen > TAG_BITSET_MAX_OPTS) return 0;
+    u8 words = 1;
+    while (words*64 < optslen) words *= 2;
+    return words;
+}
+
+// Returns the position of the first selected option of a sparse value, that is at least opt
+static u64 findTagOpt(Tag_Values vals, i32 idx, u32 opt)
+{
+    u64 lo = vals.offs[idx];
+    u64 hi = vals.offs[idx + 1];
+    while (lo < hi) {
+        u64 mid = lo + (hi - lo)/2;
+        if (vals.opts[mid] < opt) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+bool hasTag(Tag_Values vals, i32 idx, u32 opt)
+{
+    if (vals.sparse) {
+        u64 pos = findTagOpt(vals, idx, opt);
+        return pos < vals.offs[idx + 1] && vals.opts[pos] == opt;
+    }
+    if (opt >= vals.words_per_row*64u) return false;
+    return (vals.words[idx*vals.words_per_row + opt/64] >> (opt % 64)) & 1;
+}
+
+// Amount of selected options of the value
+i32 countTags(Tag_Values vals, i32 idx)
+{
+    if (vals.sparse) return vals.offs[idx + 1] - vals.offs[idx];
+    i32 count = 0;
+    for (u32 w = 0; w < vals.words_per_row; w++) count += __builtin_popcountll(vals.words[idx*vals.words_per_row + w]);
+    return count;
+}
+
+// Returns the smallest selected option of the value that is bigger than prev, or -1 if there is none
+// All selected options are iterated via: for (i32 opt = nextTag(vals, idx, -1); opt >= 0; opt = nextTag(vals, idx, opt))
+i32 nextTag(Tag_Values vals, i32 idx, i32 prev)
+{
+    u32 start = prev + 1;
+    if (vals.sparse) {
+        u64 pos = findTagOpt(vals, idx, start);
+        return pos < vals.offs[idx + 1] ? (i32) vals.opts[pos] : -1;
+    }
+    u64 *row = &vals.words[idx*vals.words_per_row];
+    for (u32 w = start/64; w < vals.words_per_row; w++) {
+        u64 word = row[w];
+        if (w == start/64) word &= ~0ull << (start % 64);
+        if (word != 0) return w*64 + __builtin_ctzll(word);
+    }
+    return -1;
+}
+
+// Sorts the list of options in place and removes duplicates
+static void sortTags(Value_Tag tags)
+{
+    i32 len = stbds_arrlen(tags);
+    for (i32 i = 1; i < len; i++) {
+        u32 opt = tags[i];
+        i32 j   = i;
+        for (; j > 0 && tags[j - 1] > opt; j--) tags[j] = tags[j - 1];
+        tags[j] = opt;
+    }
+    i32 out = 0;
+    for (i32 i = 0; i < len; i++) {
+        if (out == 0 || tags[out - 1] != tags[i]) tags[out++] = tags[i];
+    }
+    if (tags != NULL) stbds_arrsetlen(tags, out);
+}
+
+// Copies values pointing into a mapped file onto the heap, so they can be changed
+void detachTagValues(Tag_Values *vals)
+{
+    if (vals->owned) return;
+    if (vals->sparse) {
+        u64 *offs = NULL;
+        u32 *opts = NULL;
+        if (vals->offs != NULL) {
+            u64 total = vals->offs[vals->len];
+            stbds_arrsetlen(offs, vals->len + 1);
+            stbds_arrsetlen(opts, total);
+            memcpy(offs, vals->offs, (vals->len + 1) * sizeof(u64));
+            memcpy(opts, vals->opts, total * sizeof(u32));
+        }
+        vals->offs = offs;
+        vals->opts = opts;
+    } else {
+        u64 *words    = NULL;
+        u64 words_len = (u64) vals->len * vals->words_per_row;
+        stbds_arrsetlen(words, words_len);
+        memcpy(words, vals->words, words_len * sizeof(u64));
+        vals->words = words;
+    }
+    vals->owned = true;
+}
+
+void freeTagValues(Tag_Values *vals)
+{
+    if (vals->owned) {
+        stbds_arrfree(vals->words);
+        stbds_arrfree(vals->offs);
+        stbds_arrfree(vals->opts);
+    }
+    *vals = (Tag_Values) {0};
+}
+
+// Appends a sorted list of options to a sparse column
+static void appendTagEntry(Tag_Values *vals, const u32 *opts, u64 count)
+{
+    if (vals->offs == NULL) stbds_arrput(vals->offs, 0);
+    if (count > 0) memcpy(stbds_arraddnptr(vals->opts, count), opts, count * sizeof(u32));
+    stbds_arrput(vals->offs, stbds_arrlen(vals->opts));
+}
+
+// Repacks all values as bitsets with words_per_row words each, or into the sparse representation if words_per_row is 0
+void repackTagValues(Tag_Values *vals, u8 words_per_row)
+{
+    Tag_Values out = { .len = vals->len, .words_per_row = words_per_row, .sparse = words_per_row == 0, .owned = true };
+    if (!out.sparse) {
+        stbds_arrsetlen(out.words, (u64) out.len * words_per_row);
+        memset(out.words, 0, (u64) out.len * words_per_row * sizeof(u64));
+    }
+    for (i32 i = 0; i < vals->len; i++) {
+        if (out.sparse) {
+            if (out.offs == NULL) stbds_arrput(out.offs, 0);
+            for (i32 opt = nextTag(*vals, i, -1); opt >= 0; opt = nextTag(*vals, i, opt)) stbds_arrput(out.opts, opt);
+            stbds_arrput(out.offs, stbds_arrlen(out.opts));
+            continue;
+        }
+        for (i32 opt = nextTag(*vals, i, -1); opt >= 0; opt = nextTag(*vals, i, opt)) {
+            if (UNLIKELY((u32) opt >= words_per_row*64u)) break;
+            out.words[i*words_per_row + opt/64] |= 1ull << (opt % 64);
+        }
+    }
+    freeTagValues(vals);
+    *vals = out;
+}
+
+// The list of options is copied, so the caller keeps owning it
+// For sparse columns, all values after idx are moved, so this takes time proportional to the column's size
+void setTags(Tag_Values *vals, i32 idx, Value_Tag tags)
+{
+    u32 optslen = 0;
+    for (i32 k = 0; k < stbds_arrlen(tags); k++) optslen = MAX(optslen, tags[k] + 1);
+    if (UNLIKELY(!vals->sparse && optslen > vals->words_per_row*64u)) repackTagValues(vals, getTagWords(optslen));
+    detachTagValues(vals);
+    if (vals->sparse) {
+        Value_Tag sorted = NULL;
+        if (stbds_arrlen(tags) > 0) memcpy(stbds_arraddnptr(sorted, stbds_arrlen(tags)), tags, stbds_arrlen(tags) * sizeof(u32));
+        sortTags(sorted);
+        u64 count = stbds_arrlen(sorted);
+        u64 start = vals->offs[idx];
+        u64 end   = vals->offs[idx + 1];
+        u64 total = vals->offs[vals->len];
+        i64 diff  = (i64) count - (i64) (end - start);
+        if (diff > 0) stbds_arrsetlen(vals->opts, total + diff);
+        memmove(&vals->opts[end + diff], &vals->opts[end], (total - end) * sizeof(u32));
+        if (diff < 0) stbds_arrsetlen(vals->opts, total + diff);
+        if (count > 0) memcpy(&vals->opts[start], sorted, count * sizeof(u32));
+        for (i32 i = idx + 1; i <= vals->len; i++) vals->offs[i] += diff;
+        stbds_arrfree(sorted);
+        return;
+    }
+    u64 *row = &vals->words[idx*vals->words_per_row];
+    memset(row, 0, vals->words_per_row * sizeof(u64));
+    for (i32 k = 0; k < stbds_arrlen(tags); k++) row[tags[k]/64] |= 1ull << (tags[k] % 64);
+}
+
+void appendTags(Tag_Values *vals, Value_Tag tags)
+{
+    if (!vals->sparse && vals->words_per_row == 0) vals->words_per_row = 1;
+    detachTagValues(vals);
+    if (vals->sparse) {
+        appendTagEntry(vals, NULL, 0);
+    } else {
+        for (u32 w = 0; w < vals->words_per_row; w++) stbds_arrput(vals->words, 0);
+    }
+    vals->len += 1;
+    setTags(vals, vals->len - 1, tags);
+}
+
+// Returns a list of the indexes of all rows that have any (or all, if `all` is true) of the options in tags selected
+// On bitset columns, each row is compared against a mask of all options at once
+static u32* filterTags(Tag_Values vals, Value_Tag tags, bool all)
+{
+    u32 *rows = NULL;
+    if (vals.sparse) {
+        for (i32 i = 0; i < vals.len; i++) {
+            i32 found = 0;
+            for (i32 k = 0; k < stbds_arrlen(tags); k++) found += hasTag(vals, i, tags[k]);
+            if (all ? found == stbds_arrlen(tags) : found > 0) stbds_arrput(rows, i);
+        }
+        return rows;
+    }
+    u64 mask[TAG_BITSET_MAX_OPTS/64] = {0};
+    for (i32 k = 0; k < stbds_arrlen(tags); k++) {
+        // No row can have an option selected, that doesn't fit into the bitset
+        if (tags[k] >= vals.words_per_row*64u) {
+            if (all) return NULL;
+            continue;
+        }
+        mask[tags[k]/64] |= 1ull << (tags[k] % 64);
+    }
+    for (i32 i = 0; i < vals.len; i++) {
+        u64 *row = &vals.words[i*vals.words_per_row];
+        bool any = false;
+        bool every = true;
+        for (u32 w = 0; w < vals.words_per_row; w++) {
+            u64 m = row[w] & mask[w];
+            any   |= m != 0;
+            every &= m == mask[w];
+        }
+        if (all ? every : any) stbds_arrput(rows, i);
+    }
+    return rows;
+}
+
+u32* filterTagsAny(Tag_Values vals, Value_Tag tags)
+{
+    return filterTags(vals, tags, false);
+}
+
+u32* filterTagsAll(Tag_Values vals, Value_Tag tags)
+{
+    return filterTags(vals, tags, true);
+}
+
+i32 getValuesLen(Values vals, Datatype type)
+{
+    switch (type)
+    {
+    case TYPE_STR:
+        return vals.strs.len;
+    case TYPE_SELECT:
+        return vals.selects.len;
+    case TYPE_TAG:
+        return vals.tags.len;
+    case TYPE_DATE:
+        return stbds_arrlen(vals.dates);
+    case TYPE_LEN:
+        PANIC("Received illegal column type 'len'");
+    }
+    return 0;
+}
+
+// Appends default values until there are `rows` values
+void padValues(Values *vals, Datatype type, i32 rows)
+{
+    i32 len = getValuesLen(*vals, type);
+    if (len >= rows) return;
+    switch (type)
+    {
+    case TYPE_STR:
+        for (i32 i = len; i < rows; i++) appendStr(&vals->strs, (Value_Str){VALUE_DEFAULT_STR});
+        break;
+    case TYPE_SELECT:
+        for (i32 i = len; i < rows; i++) appendSelect(&vals->selects, VALUE_DEFAULT_SELECT);
+        break;
+    case TYPE_TAG:
+        for (i32 i = len; i < rows; i++) appendTags(&vals->tags, (Value_Tag){VALUE_DEFAULT_TAG});
+        break;
+    case TYPE_DATE:
+        stbds_arrsetlen(vals->dates, rows);
+        memset(&vals->dates[len], VALUE_DEFAULT_DATE, (rows - len) * sizeof(Value_Date));
+        break;
+    case TYPE_LEN:
+        PANIC("Can't add values to a column of type 'len'");
+    }
+}
+
+void freeValues(Values *vals, Datatype type)
+{
+    switch (type)
+    {
+    case TYPE_STR:
+        if (vals->strs.owned) {
+            stbds_arrfree(vals->strs.offs);
+            stbds_arrfree(vals->strs.bytes);
+            stbds_arrfree(vals->strs.codes);
+        }
+        break;
+    case TYPE_SELECT:
+        if (vals->selects.owned) stbds_arrfree(vals->selects.words);
+        break;
+    case TYPE_TAG:
+        freeTagValues(&vals->tags);
+        break;
+    case TYPE_DATE:
+        stbds_arrfree(vals->dates);
+        break;
+    case TYPE_LEN:
+        PANIC("Can't free values of a column of type 'len'");
+    }
+    *vals = (Values) {0};
+}
+
+// Returns a copy of the values, that doesn't share any memory with them
+Values copyValues(Values vals, Datatype type)
+{
+    switch (type)
+    {
+    case TYPE_STR:
+        vals.strs.owned = false;
+        detachStrValues(&vals.strs);
+        break;
+    case TYPE_SELECT:
+        vals.selects.owned = false;
+        detachSelectValues(&vals.selects);
+        break;
+    case TYPE_TAG:
+        vals.tags.owned = false;
+        detachTagValues(&vals.tags);
+        break;
+    case TYPE_DATE: {
+        Value_Date *dates = NULL;
+        i32 len = stbds_arrlen(vals.dates);
+        if (len > 0) memcpy(stbds_arraddnptr(dates, len), vals.dates, len * sizeof(Value_Date));
+        vals.dates = dates;
+        break;
+    }
+    case TYPE_LEN:
+        PANIC("Can't copy values of a column of type 'len'");
+    }
+    return vals;
+}
+
+// Appends the values of src to dst, converting them to the representation of dst where needed. src isn't changed
+// Dictionaries are merged as long as that fits into STR_DICT_MAX_LEN entries
+static void appendValues(Values *dst, Values src, Datatype type)
+{
+    i32 len = getValuesLen(src, type);
+    if (len == 0) return;
+    switch (type)
+    {
+    case TYPE_STR:
+        {
+        Str_Values *d = &dst->strs;
+        Str_Values  s = src.strs;
+        detachStrValues(d);
+        if (d->codes != NULL && s.codes != NULL) {
+            u16 *codes = malloc(s.dict_len * sizeof(u16));
+            bool ok    = true;
+            for (i32 i = 0; i < s.dict_len && ok; i++) {
+                i32 code = getStrCode(d, getStr((Str_Values){ .offs = s.offs, .bytes = s.bytes }, i));
+                codes[i] = code;
+                ok       = code >= 0;
+            }
+            if (ok) {
+                u16 *out = stbds_arraddnptr(d->codes, len);
+                for (i32 i = 0; i < len; i++) out[i] = codes[s.codes[i]];
+                d->len += len;
+            }
+            free(codes);
+            if (ok) break;
+        }
+        undictStrValues(d);
+        if (d->offs == NULL) stbds_arrput(d->offs, 0);
+        if (s.codes == NULL) {
+            u64 base  = stbds_arrlen(d->bytes);
+            u64 start = s.offs[0];
+            u64 size  = s.offs[len] - start;
+            if (size > 0) memcpy(stbds_arraddnptr(d->bytes, size), &s.bytes[start], size);
+            u64 *offs = stbds_arraddnptr(d->offs, len);
+            for (i32 i = 0; i < len; i++) offs[i] = base + s.offs[i + 1] - start;
+        } else {
+            for (i32 i = 0; i < len; i++) appendStrEntry(d, getStr(s, i));
+        }
+        d->len += len;
+        }
+        break;
+    case TYPE_SELECT:
+        {
+        Select_Values *d = &dst->selects;
+        Select_Values  s = src.selects;
+        u8 bits = MAX(MAX(d->bits, s.bits), 1);
+        if (d->bits != bits) resizeSelectValues(d, bits);
+        detachSelectValues(d);
+        // Repacking s mustn't free the words of src
+        s.owned = false;
+        if (s.bits != bits) resizeSelectValues(&s, bits);
+        if ((d->len * bits) % 64 == 0) {
+            u32 words_len = (len * bits + 63) / 64;
+            memcpy(stbds_arraddnptr(d->words, words_len), s.words, words_len * sizeof(u64));
+            d->len += len;
+        } else {
+            for (i32 i = 0; i < len; i++) appendSelect(d, getSelect(s, i));
+        }
+        if (s.owned) stbds_arrfree(s.words);
+        }
+        break;
+    case TYPE_TAG:
+        {
+        Tag_Values *d = &dst->tags;
+        Tag_Values  s = src.tags;
+        bool sparse = d->sparse || s.sparse;
+        u8   words  = sparse ? 0 : MAX(MAX(d->words_per_row, s.words_per_row), 1);
+        if (d->sparse != sparse || d->words_per_row != words) repackTagValues(d, words);
+        detachTagValues(d);
+        // Repacking s mustn't free the arrays of src
+        s.owned = false;
+        if (s.sparse != sparse || s.words_per_row != words) repackTagValues(&s, words);
+        if (sparse) {
+            if (d->offs == NULL) stbds_arrput(d->offs, 0);
+            u64 base  = stbds_arrlen(d->opts);
+            u64 start = s.offs[0];
+            u64 total = s.offs[len] - start;
+            if (total > 0) memcpy(stbds_arraddnptr(d->opts, total), &s.opts[start], total * sizeof(u32));
+            u64 *offs = stbds_arraddnptr(d->offs, len);
+            for (i32 i = 0; i < len; i++) offs[i] = base + s.offs[i + 1] - start;
+        } else {
+            u64 words_len = (u64) len * words;
+            memcpy(stbds_arraddnptr(d->words, words_len), s.words, words_len * sizeof(u64));
+        }
+        d->len += len;
+        freeTagValues(&s);
+        }
+        break;
+    case TYPE_DATE:
+        memcpy(stbds_arraddnptr(dst->dates, len), src.dates, len * sizeof(Value_Date));
+        break;
+    case TYPE_LEN:
+        PANIC("Can't append values to a column of type 'len'");
+    }
+}
+
+// Joins the values of the chunks of a column (see Column_Chunk) into the values of the whole column and frees them
+// A single chunk is returned as it is, so that its values can keep pointing into the mapped file
+static Values joinChunkValues(Values *parts, i32 len, Datatype type, u32 group_rows)
+{
+    if (len == 1) return parts[0];
+    // Starting from the first chunk keeps its representation, e.g. a dictionary, which the later chunks are merged into
+    Values out = parts[0];
+    for (i32 g = 1; g < len; g++) {
+        // Chunks with fewer rows than their row group only occur if rows were added without the chunk being rewritten
+        padValues(&out, type, g * group_rows);
+        appendValues(&out, parts[g], type);
+        freeValues(&parts[g], type);
+    }
+    return out;
+}
+
+// Returns the len values from row start on, which still point into vals. The result is only meant to be written (see writeValues)
+// start must be a multiple of 64, so that packed TYPE_SELECT values start at a word
+static Values sliceValues(Values vals, Datatype type, i32 start, i32 len)
+{
+    switch (type)
+    {
+    case TYPE_STR:
+        if (vals.strs.codes != NULL) vals.strs.codes = &vals.strs.codes[start];
+        else if (vals.strs.offs != NULL) vals.strs.offs = &vals.strs.offs[start];
+        vals.strs.len = len;
+        break;
+    case TYPE_SELECT:
+        if (vals.selects.words != NULL) vals.selects.words = &vals.selects.words[start * vals.selects.bits / 64];
+        vals.selects.len = len;
+        break;
+    case TYPE_TAG:
+        if (vals.tags.sparse && vals.tags.offs != NULL) vals.tags.offs = &vals.tags.offs[start];
+        else if (!vals.tags.sparse && vals.tags.words != NULL) vals.tags.words = &vals.tags.words[start * vals.tags.words_per_row];
+        vals.tags.len = len;
+        break;
+    case TYPE_DATE:
+        // The slice isn't a dynamic array anymore, so its length has to be passed along with it
+        if (vals.dates != NULL) vals.dates = &vals.dates[start];
+        break;
+    case TYPE_LEN:
+        PANIC("Can't slice values of a column of type 'len'");
+    }
+    return vals;
+}
+
+// Reads a TYPE_STR column in the plain layout (see writeStrs). The result points into the buffer
+static Str_Values readStrs(Buffer *buf, i32 len)
+{
+    u64 size = buf_read8(buf);
+    Str_Values vals = {
+        .offs  = (u64*)  &buf->data[buf->idx],
+        .bytes = (char*) &buf->data[buf->idx + (len + 1) * sizeof(u64)],
+        .len   = len,
+        .owned = false,
+    };
+    buf->idx += (len + 1) * sizeof(u64) + size;
+    return vals;
+}
+
+// Reads a TYPE_STR column in the varint layout (see writeVarintStrs)
+// The result is always owned, as the offsets have to be computed from the lengths anyway
+static Str_Values readVarintStrs(Buffer *buf, i32 len)
+{
+    u64  size = buf_readVarint(buf);
+    u32 *lens = malloc(len * sizeof(u32));
+    buf_readGroupVarints(buf, lens, len);
+    Str_Values vals = { .len = len, .owned = true };
+    if (len > 0) {
+        stbds_arrsetlen(vals.offs, len + 1);
+        vals.offs[0] = 0;
+        for (i32 i = 0; i < len; i++) vals.offs[i + 1] = vals.offs[i] + lens[i];
+        stbds_arrsetlen(vals.bytes, size);
+        memcpy(vals.bytes, &buf->data[buf->idx], size);
+    }
+    buf->idx += size;
+    free(lens);
+    return vals;
+}
+
+// Reads a TYPE_STR column in the slotted layout (see writeSlotStrs), whose values are copied out of the heap
+// The result is always owned, as the values are spread over the heap
+static Str_Values readSlotStrs(Buffer *buf, i32 len, String_View heap)
+{
+    u64 *offs = malloc(len * sizeof(u64));
+    u32 *lens = malloc(len * sizeof(u32));
+    buf_readArray(buf, offs, sizeof(u64), len);
+    buf_readArray(buf, lens, sizeof(u32), len);
+    Str_Values vals = { .len = len, .owned = true };
+    if (len > 0) {
+        stbds_arrsetlen(vals.offs, len + 1);
+        vals.offs[0] = 0;
+        for (i32 i = 0; i < len; i++) {
+            // Checked chunks never point outside of the heap. Partially patched ones might, but their cells are restored from the write-ahead log
+            if (UNLIKELY(offs[i] > heap.count || lens[i] > heap.count - offs[i])) lens[i] = 0;
+            vals.offs[i + 1] = vals.offs[i] + lens[i];
+        }
+        stbds_arrsetlen(vals.bytes, vals.offs[len]);
+        for (i32 i = 0; i < len; i++) {
+            if (lens[i] > 0) memcpy(&vals.bytes[vals.offs[i]], &heap.data[offs[i]], lens[i]);
+        }
+    }
+    free(offs);
+    free(lens);
+    return vals;
+}
+
+// Reads a sparse TYPE_TAG column in the varint layout (see writeValues). The result is always owned
+static Tag_Values readVarintTags(Buffer *buf, i32 len)
+{
+    u64  total  = buf_readVarint(buf);
+    u32 *counts = malloc(len * sizeof(u32));
+    buf_readGroupVarints(buf, counts, len);
+    Tag_Values vals = { .len = len, .sparse = true, .owned = true };
+    stbds_arrsetlen(vals.offs, len + 1);
+    vals.offs[0] = 0;
+    for (i32 r = 0; r < len; r++) vals.offs[r + 1] = vals.offs[r] + counts[r];
+    stbds_arrsetlen(vals.opts, total);
+    buf_readGroupVarints(buf, vals.opts, total);
+    // Options after the first one of each value are stored as the difference to the previous one
+    for (i32 r = 0; r < len; r++) {
+        for (u64 k = vals.offs[r] + 1; k < vals.offs[r + 1]; k++) vals.opts[k] += vals.opts[k - 1];
+    }
+    free(counts);
+    return vals;
+}
+
+// Key of a date, that orders dates by year, month and day and can be converted back without loss
+// Only valid for dates with day < 32 and month < 16
+static inline i32 getDateKey(Value_Date date)
+{
+    return (i32) date.year * 512 + date.month * 32 + date.day;
+}
+
+static inline Value_Date getDateFromKey(i32 key)
+{
+    return (Value_Date) { .day = key & 31, .month = (key >> 5) & 15, .year = (i16) ((key - (key & 511)) / 512) };
+}
+
+static inline bool isDateEmpty(Value_Date date)
+{
+    return date.day == 0 || date.month == 0 || date.year == 0;
+}
+
+// Writes a TYPE_SELECT column as runs of equal values:
+// u8 bits, varint amount of runs, group varint stored values[runs] (value+1 as in Select_Values), group varint lengths[runs]
+// Returns false without writing anything, if that isn't smaller than the packed layout or the values need more than SELECT_RLE_MAX_BITS bits
+static bool writeRunSelects(Buffer *buf, Select_Values vals)
+{
+    if (vals.bits > SELECT_RLE_MAX_BITS) return false;
+    u32 runs = 0;
+    for (i32 i = 0; i < vals.len; i++) runs += i == 0 || getSelect(vals, i) != getSelect(vals, i - 1);
+    if ((u64) runs * SELECT_RLE_RUN_SIZE >= (u64) (vals.len * vals.bits + 63) / 64 * sizeof(u64)) return false;
+    u32 *values = malloc(runs * sizeof(u32));
+    u32 *lens   = malloc(runs * sizeof(u32));
+    u32 run     = 0;
+    for (i32 i = 0; i < vals.len; i++) {
+        u32 stored = getSelect(vals, i) + 1;
+        if (i > 0 && stored == values[run - 1]) {
+            lens[run - 1]++;
+        } else {
+            values[run] = stored;
+            lens[run]   = 1;
+            run++;
+        }
+    }
+    buf_write8(buf, vals.bits);
+    buf_writeVarint(buf, runs);
+    buf_writeGroupVarints(buf, values, runs);
+    buf_writeGroupVarints(buf, lens, runs);
+    free(values);
+    free(lens);
+    return true;
+}
+
+// Reads the runs of a run-length encoded TYPE_SELECT column of len rows (see writeRunSelects). values and lens must be freed by the caller
+static u32 readSelectRuns(Buffer *buf, i32 len, u8 *bits, u32 **values, u32 **lens)
+{
+    *bits    = buf_read8(buf);
+    u32 runs = buf_readVarint(buf);
+    if (UNLIKELY(*bits == 0 || *bits > SELECT_RLE_MAX_BITS || runs > (u32) len)) PANIC("Run-length encoded column chunk is corrupted");
+    *values  = malloc(runs * sizeof(u32));
+    *lens    = malloc(runs * sizeof(u32));
+    buf_readGroupVarints(buf, *values, runs);
+    buf_readGroupVarints(buf, *lens, runs);
+    u64 total = 0;
+    for (u32 k = 0; k < runs; k++) {
+        if (UNLIKELY((*lens)[k] == 0 || ((*values)[k] >> *bits) != 0)) PANIC("Run-length encoded column chunk is corrupted");
+        total += (*lens)[k];
+    }
+    if (UNLIKELY(total != (u64) len)) PANIC("Run-length encoded column chunk is corrupted");
+    return runs;
+}
+
+static Select_Values readRunSelects(Buffer *buf, i32 len)
+{
+    u32 *values, *lens;
+    u8   bits;
+    u32  runs = readSelectRuns(buf, len, &bits, &values, &lens);
+    Select_Values vals = { .len = len, .bits = bits, .owned = true };
+    u32 per_word  = 64 / bits;
+    u32 words_len = (len + per_word - 1) / per_word;
+    stbds_arrsetlen(vals.words, words_len);
+    memset(vals.words, 0, words_len * sizeof(u64));
+    i32 row = 0;
+    for (u32 k = 0; k < runs; k++) {
+        if (values[k] == 0) {
+            row += lens[k];
+            continue;
+        }
+        for (u32 end = row + lens[k]; (u32) row < end; row++) vals.words[row / per_word] |= (u64) values[k] << ((row % per_word) * bits);
+    }
+    free(values);
+    free(lens);
+    return vals;
+}
+
+// Packs the differences, whose bits overlap with the word-th word of a delta-encoded TYPE_DATE column (see writeDeltaDates)
+// Lets patchTabFile rewrite single words of the column
+static u64 packDeltaDateWord(const Value_Date *dates, i32 len, i32 min, u8 width, u64 word)
+{
+    u64 out = 0;
+    if (width == 0) return out;
+    for (u64 i = word * 64 / width; i + 1 < (u64) len && i * width < (word + 1) * 64; i++) {
+        u64 val = (u64) (getDateKey(dates[i + 1]) - getDateKey(dates[i]) - min);
+        u64 bit = i * width;
+        if (bit >= word * 64) out |= val << (bit - word * 64);
+        else out |= val >> (word * 64 - bit);
+    }
+    return out;
+}
+
+// Writes a delta-encoded TYPE_DATE column (see writeDeltaDates) with the given smallest difference and width
+static void writeDeltaDatesWith(Buffer *buf, const Value_Date *dates, i32 len, i32 min, u8 width)
+{
+    u64 words_len = ((u64) (len - 1) * width + 63) / 64;
+    buf_write4i(buf, getDateKey(dates[0]));
+    buf_write4i(buf, min);
+    buf_write8(buf, width);
+    for (u64 w = 0; w < words_len; w++) buf_write8(buf, packDeltaDateWord(dates, len, min, width, w));
+}
+
+// Writes a TYPE_DATE column as the differences between the keys (see getDateKey) of consecutive dates.
+// The smallest difference is subtracted from all of them (frame of reference) and they are bit-packed with the smallest width:
+// i32 first key, i32 smallest difference, u64 width, u64 words[]
+// Returns false without writing anything, if that isn't smaller than the plain layout
+static bool writeDeltaDates(Buffer *buf, Value_Date *dates, i32 len)
+{
+    if (len < 2) return false;
+    i32 min = INT32_MAX;
+    i32 max = INT32_MIN;
+    for (i32 i = 0; i < len; i++) {
+        if (dates[i].day >= 32 || dates[i].month >= 16) return false;
+        if (i == 0) continue;
+        i32 delta = getDateKey(dates[i]) - getDateKey(dates[i - 1]);
+        min = MIN(min, delta);
+        max = MAX(max, delta);
+    }
+    u8 width = 0;
+    while (((u64) (max - min) >> width) != 0) width++;
+    u64 words_len = ((u64) (len - 1) * width + 63) / 64;
+    if (2*sizeof(i32) + sizeof(u64) + words_len * sizeof(u64) >= (u64) len * sizeof(Value_Date)) return false;
+    writeDeltaDatesWith(buf, dates, len, min, width);
+    return true;
+}
+
+// Decodes the keys of a delta-encoded TYPE_DATE column (see writeDeltaDates) into keys, which must have room for len keys
+static void readDeltaDateKeys(Buffer *buf, i32 len, i32 *keys)
+{
+    i32 key   = buf_read4i(buf);
+    i32 min   = buf_read4i(buf);
+    u8  width = buf_read8(buf);
+    const u64 *words = (const u64*) &buf->data[buf->idx];
+    u64 mask = width == 64 ? ~0ull : (1ull << width) - 1;
+    if (len > 0) keys[0] = key;
+    for (i32 i = 1; i < len; i++) {
+        // Constant deltas are stored without any words
+        u64 bit = (u64) (i - 1) * width;
+        u64 val = width == 0 ? 0 : words[bit / 64] >> (bit % 64);
+        if (bit % 64 + width > 64) val |= words[bit / 64 + 1] << (64 - bit % 64);
+        key    += (i32) (val & mask) + min;
+        keys[i] = key;
+    }
+    if (len > 1) buf->idx += ((u64) (len - 1) * width + 63) / 64 * sizeof(u64);
+}
+
+// If `ref` is true, strings point into the buffer instead of being copied
+// `version` is the format version of the file the buffer was read from and `enc` the encoding of the column
+// `heap` is the file's string heap, that ENC_SLOT columns are read from
+Values readValues(Buffer *buf, Datatype type, i32 rowslen, bool ref, u32 version, Encoding enc, String_View heap)
+{
+    Values vals = {0};
+    switch (type)
+    {
+    case TYPE_STR:
+        if (version < 3) {
+            // Before version 3, each value was stored with its own length prefix
+            for (i32 r = 0; r < rowslen; r++) appendStr(&vals.strs, buf_readSVRef(buf));
+            break;
+        }
+        if (enc == ENC_DICT) {
+            i32 dict_len = buf_read8(buf);
+            vals.strs = readStrs(buf, dict_len);
+            while (buf->idx % sizeof(u64) != 0) buf->idx++;
+            vals.strs.codes    = (u16*) &buf->data[buf->idx];
+            vals.strs.len      = rowslen;
+            vals.strs.dict_len = dict_len;
+            buf->idx += rowslen * sizeof(u16);
+        } else if (enc == ENC_VARINT) {
+            vals.strs = readVarintStrs(buf, rowslen);
+        } else if (enc == ENC_SLOT) {
+            vals.strs = readSlotStrs(buf, rowslen, heap);
+        } else {
+            vals.strs = readStrs(buf, rowslen);
+        }
+        if (!ref) detachStrValues(&vals.strs);
+        break;
+    case TYPE_SELECT:
+        if (version < 5) {
+            // Before version 5, each value was stored as an i32
+            for (i32 r = 0; r < rowslen; r++) appendSelect(&vals.selects, buf_read4i(buf));
+            break;
+        }
+        if (enc == ENC_RLE) {
+            vals.selects = readRunSelects(buf, rowslen);
+            break;
+        }
+        {
+        u8 bits = buf_read8(buf);
+        vals.selects = (Select_Values) {
+            .bits  = bits,
+            .words = (u64*) &buf->data[buf->idx],
+            .len   = rowslen,
+            .owned = false,
+        };
+        buf->idx += (rowslen * vals.selects.bits + 63) / 64 * sizeof(u64);
+        if (!ref) detachSelectValues(&vals.selects);
+        }
+        break;
+    case TYPE_TAG:
+        {
+        // Before version 6, every value was stored as a list of options
+        u8 words_per_row = version < 6 ? 0 : buf_read8(buf);
+        if (words_per_row > 0) {
+            vals.tags = (Tag_Values) {
+                .words         = (u64*) &buf->data[buf->idx],
+                .len           = rowslen,
+                .words_per_row = words_per_row,
+                .owned         = false,
+            };
+            buf->idx += (u64) rowslen * words_per_row * sizeof(u64);
+            if (!ref) detachTagValues(&vals.tags);
+            break;
+        }
+        if (enc == ENC_VARINT) {
+            vals.tags = readVarintTags(buf, rowslen);
+            break;
+        }
+        if (version >= 7) {
+            u64 total = buf_read8(buf);
+            vals.tags = (Tag_Values) {
+                .offs   = (u64*) &buf->data[buf->idx],
+                .opts   = (u32*) &buf->data[buf->idx + (rowslen + 1) * sizeof(u64)],
+                .len    = rowslen,
+                .sparse = true,
+                .owned  = false,
+            };
+            buf->idx += (rowslen + 1) * sizeof(u64) + total * sizeof(u32);
+            if (!ref) detachTagValues(&vals.tags);
+            break;
+        }
+        // Before version 7, sparse values were stored as a list of options per value
+        vals.tags = (Tag_Values) { .len = rowslen, .sparse = true, .owned = true };
+        stbds_arrsetcap(vals.tags.offs, rowslen + 1);
+        Value_Tag tag = NULL;
+        for (i32 r = 0; r < rowslen; r++) {
+            i32 amount = buf_read4i(buf);
+            stbds_arrsetlen(tag, 0);
+            for (i32 k = 0; k < amount; k++) {
+                i32 idx = buf_read4i(buf);
+                stbds_arrput(tag, idx);
+            }
+            sortTags(tag);
+            appendTagEntry(&vals.tags, tag, stbds_arrlen(tag));
+        }
+        stbds_arrfree(tag);
+        }
+        break;
+    case TYPE_DATE:
+        stbds_arrsetlen(vals.dates, rowslen);
+        if (enc == ENC_DELTA) {
+            i32 *keys = malloc(rowslen * sizeof(i32));
+            readDeltaDateKeys(buf, rowslen, keys);
+            for (i32 r = 0; r < rowslen; r++) vals.dates[r] = getDateFromKey(keys[r]);
+            free(keys);
+            break;
+        }
+        // Dates are stored in the layout of Value_Date (see writeValues)
+        buf_readArray(buf, vals.dates, sizeof(Value_Date), rowslen);
+        break;
+    default:
+        PANIC("Unexpected column type '%d' when reading values", type);
+    }
+    return vals;
+}
+
+// Total length of all values in bytes
+static u64 getStrsSize(Str_Values vals)
+{
+    if (vals.codes == NULL) return vals.len == 0 ? 0 : vals.offs[vals.len] - vals.offs[0];
+    u64 size = 0;
+    for (i32 i = 0; i < vals.len; i++) size += getStr(vals, i).count;
+    return size;
+}
+
+// Writes the values of a TYPE_STR column in the plain layout: u64 size of bytes, u64 offs[len+1], bytes
+// Dictionary-encoded columns are expanded. The offsets of a slice (see sliceValues) are rebased to start at 0
+// The arrays of the values are only referenced by gathering buffers (see buf_writeRef), if `ref` is true
+static void writeStrs(Buffer *buf, Str_Values vals, bool ref)
+{
+    u64 size = getStrsSize(vals);
+    if (vals.codes == NULL) {
+        u64 start = vals.len == 0 ? 0 : vals.offs[0];
+        buf_write8(buf, size);
+        if (vals.len == 0) buf_write8(buf, 0);
+        else if (start == 0 && ref) buf_writeRef(buf, vals.offs, (vals.len + 1) * sizeof(u64));
+        else if (start == 0) buf_writeBytes(buf, vals.offs, (vals.len + 1) * sizeof(u64));
+        else for (i32 i = 0; i <= vals.len; i++) buf_write8(buf, vals.offs[i] - start);
+        if (ref) buf_writeRef(buf, &vals.bytes[start], size);
+        else     buf_writeBytes(buf, &vals.bytes[start], size);
+        return;
+    }
+    buf_write8(buf, size);
+    buf_write8(buf, 0);
+    u64 off = 0;
+    for (i32 i = 0; i < vals.len; i++) {
+        off += getStr(vals, i).count;
+        buf_write8(buf, off);
+    }
+    for (i32 i = 0; i < vals.len; i++) {
+        String_View sv = getStr(vals, i);
+        buf_writeRef(buf, sv.data, sv.count);
+    }
+}
+
+// Writes the values of a TYPE_STR column in the varint layout: varint size of bytes, group varint lengths[len], bytes
+// Unlike the plain layout, it can't be used straight from the mapped file, so it is only used for short values,
+// where the offsets would make up a large part of the column
+static void writeVarintStrs(Buffer *buf, Str_Values vals, u64 size)
+{
+    u32 *lens = malloc(vals.len * sizeof(u32));
+    for (i32 i = 0; i < vals.len; i++) lens[i] = getStr(vals, i).count;
+    buf_writeVarint(buf, size);
+    buf_writeGroupVarints(buf, lens, vals.len);
+    if (vals.codes == NULL) {
+        buf_writeRef(buf, vals.len == 0 ? vals.bytes : &vals.bytes[vals.offs[0]], size);
+    } else {
+        for (i32 i = 0; i < vals.len; i++) {
+            String_View sv = getStr(vals, i);
+            buf_writeRef(buf, sv.data, sv.count);
+        }
+    }
+    free(lens);
+}
+
+// Writes the values of a TYPE_STR column in the slotted layout: u64 offset into the heap per value, u32 length per value
+// The values themselves are appended to the heap, so a changed value only has to update its slot (see patchTabFile)
+static void writeSlotStrs(Buffer *buf, Str_Values vals, Buffer *heap)
+{
+    if (vals.codes == NULL) {
+        // The values already follow each other in memory, so they are appended to the heap all at once
+        u64 start = vals.len == 0 ? 0 : vals.offs[0];
+        u64 base  = buf_len(*heap);
+        for (i32 i = 0; i < vals.len; i++) buf_write8(buf, vals.offs[i + 1] == vals.offs[i] ? 0 : base + vals.offs[i] - start);
+        buf_writeRef(heap, &vals.bytes[start], getStrsSize(vals));
+    } else {
+        for (i32 i = 0; i < vals.len; i++) {
+            String_View sv = getStr(vals, i);
+            buf_write8(buf, sv.count == 0 ? 0 : buf_len(*heap));
+            if (sv.count > 0) buf_writeRef(heap, sv.data, sv.count);
+        }
+    }
+    for (i32 i = 0; i < vals.len; i++) buf_write4(buf, getStr(vals, i).count);
+}
+
+// Returns the encoding that was chosen for the values
+// TYPE_STR columns are dictionary-encoded whenever they have few distinct values
+// and otherwise store their lengths as varints, if the values are short. With TAB_STR_SLOTS, they are stored in `heap` instead,
+// unless heap is NULL, as for chunks in segment files
+// TYPE_SELECT and TYPE_DATE columns are run-length/delta encoded, whenever that is smaller
+// The amount of values is passed as rowslen, as slices of TYPE_DATE columns (see sliceValues) don't know it
+Encoding writeValues(Buffer *buf, Datatype type, Values vals, i32 rowslen, Buffer *heap)
+{
+    Encoding enc = ENC_PLAIN;
+    switch (type)
+    {
+    case TYPE_STR:
+        {
+        Str_Values dict = {0};
+        if (buildStrDict(vals.strs, &dict)) {
+            enc = ENC_DICT;
+            buf_write8(buf, dict.dict_len);
+            // The dictionary is freed right away, so it is copied
+            writeStrs(buf, (Str_Values){ .offs = dict.offs, .bytes = dict.bytes, .len = dict.dict_len }, false);
+            while (buf_len(*buf) % sizeof(u64) != 0) buf_write1(buf, 0);
+            buf_writeBytes(buf, dict.codes, dict.len * sizeof(u16));
+            stbds_arrfree(dict.offs);
+            stbds_arrfree(dict.bytes);
+            stbds_arrfree(dict.codes);
+        } else if (TAB_STR_SLOTS && heap != NULL) {
+            enc = ENC_SLOT;
+            writeSlotStrs(buf, vals.strs, heap);
+        } else {
+            u64 size = getStrsSize(vals.strs);
+            if (size < (u64) rowslen * STR_VARINT_MAX_AVG_LEN) {
+                enc = ENC_VARINT;
+                writeVarintStrs(buf, vals.strs, size);
+            } else {
+                writeStrs(buf, vals.strs, true);
+            }
+        }
+        }
+        break;
+
+    case TYPE_SELECT:
+        if (writeRunSelects(buf, vals.selects)) {
+            enc = ENC_RLE;
+            break;
+        }
+        // u64 bits per value, u64 words[]
+        buf_write8(buf, vals.selects.bits);
+        buf_writeRef(buf, vals.selects.words, (rowslen * vals.selects.bits + 63) / 64 * sizeof(u64));
+        break;
+
+    case TYPE_TAG:
+        // u64 words per value, followed by u64 words[] for bitsets
+        // Sparse columns store 0 words per value, followed by varint amount of selected options,
+        // group varint amount of options per value, group varint options (each after the first one of a value as the difference to the previous one)
+        if (!vals.tags.sparse) {
+            u8 words_per_row = MAX(vals.tags.words_per_row, 1);
+            buf_write8(buf, words_per_row);
+            buf_writeRef(buf, vals.tags.words, (u64) rowslen * words_per_row * sizeof(u64));
+            break;
+        }
+        {
+        enc = ENC_VARINT;
+        u64 first   = rowslen == 0 ? 0 : vals.tags.offs[0];
+        u64 total   = rowslen == 0 ? 0 : vals.tags.offs[rowslen] - first;
+        u32 *counts = malloc(rowslen * sizeof(u32));
+        u32 *deltas = malloc(total * sizeof(u32));
+        for (i32 r = 0; r < rowslen; r++) {
+            u64 start = vals.tags.offs[r];
+            counts[r] = vals.tags.offs[r + 1] - start;
+            for (u64 k = start; k < vals.tags.offs[r + 1]; k++) {
+                deltas[k - first] = k == start ? vals.tags.opts[k] : vals.tags.opts[k] - vals.tags.opts[k - 1];
+            }
+        }
+        buf_write8(buf, 0);
+        buf_writeVarint(buf, total);
+        buf_writeGroupVarints(buf, counts, rowslen);
+        buf_writeGroupVarints(buf, deltas, total);
+        free(counts);
+        free(deltas);
+        }
+        break;
+
+    case TYPE_DATE:
+        if (writeDeltaDates(buf, vals.dates, rowslen)) {
+            enc = ENC_DELTA;
+            break;
+        }
+        // u8 day, u8 month, u16 year per value, which is the layout of Value_Date
+        STATIC_ASSERT(sizeof(Value_Date) == 4);
+        buf_writeRef(buf, vals.dates, (u64) rowslen * sizeof(Value_Date));
+        break;
+    default:
+        PANIC("Unexpected column type '%d' when writing values", type);
+    }
+    return enc;
+}
+
+// Widens the statistics to include the value of the row. Statistics of other types always match (see CHUNK_STATS_ANY)
+static void widenChunkStats(Chunk_Stats *stats, Datatype type, Values vals, u32 row)
+{
+    if (type == TYPE_SELECT) {
+        stats->mask |= 1ull << MIN(getSelect(vals.selects, row) + 1, 63);
+    } else if (type == TYPE_DATE && !isDateEmpty(vals.dates[row])) {
+        i32 key    = getDateKey(vals.dates[row]);
+        stats->min = MIN(stats->min, key);
+        stats->max = MAX(stats->max, key);
+    }
+}
+
+// Statistics of the first len values (see Chunk_Stats)
+static Chunk_Stats getChunkStats(Datatype type, Values vals, i32 len)
+{
+    Chunk_Stats stats = CHUNK_STATS_ANY;
+    if (type == TYPE_SELECT) stats.mask = 0;
+    if (type == TYPE_DATE) {
+        stats.min = INT32_MAX;
+        stats.max = INT32_MIN;
+    }
+    for (i32 i = 0; i < len && (type == TYPE_SELECT || type == TYPE_DATE); i++) widenChunkStats(&stats, type, vals, i);
+    return stats;
+}
+
+// Whether the chunk might contain values the scan looks for
+static bool mayChunkMatch(Datatype type, Chunk_Stats stats, Column_Scan *scan)
+{
+    if (type == TYPE_SELECT) {
+        u64 stored = scan->from.select < 0 ? 0 : (u64) scan->from.select + 1;
+        return (stats.mask >> MIN(stored, 63)) & 1;
+    }
+    return type != TYPE_DATE || (stats.max >= getDateKey(scan->from.date) && stats.min <= getDateKey(scan->to.date));
+}
+
+// Adapts the representation of the values to the amount of options of the column
+// Select columns are widened and tag columns switch from bitsets to the sparse representation once they have too many options
+static void fitValuesToOpts(Column col, Values *vals)
+{
+    u64 optslen = stbds_arrlen(col.opts.strs);
+    if (col.type == TYPE_SELECT) {
+        u8 bits = getSelectBits(optslen);
+        if (vals->selects.bits < bits) resizeSelectValues(&vals->selects, bits);
+    } else if (col.type == TYPE_TAG) {
+        u8 words = getTagWords(optslen);
+        if (words == 0 ? !vals->tags.sparse : (vals->tags.sparse || vals->tags.words_per_row < words)) repackTagValues(&vals->tags, words);
+    }
+}
+
+// Whether the chunk lies within the file and its content matches its checksum
+// Files before version 8 have no checksums, so only the bounds are checked
+static bool isChunkValid(const u8 *data, u64 size, Column_Chunk chunk, u32 version)
+{
+    if (UNLIKELY(chunk.off > size || chunk.size > size - chunk.off)) return false;
+    return version < 8 || util_crc32c(0, &data[chunk.off], chunk.size) == chunk.crc;
+}
+
+// Reads the values of a chunk, which starts at buf->idx, decompressing it first if needed
+// Values of compressed chunks are always owned, as the decompressed data is only temporary
+static Values readChunkValues(Buffer *buf, Column_Chunk chunk, Datatype type, bool ref, u32 version, String_View heap)
+{
+    if (chunk.raw_size == chunk.size) return readValues(buf, type, chunk.rows, ref, version, chunk.enc, heap);
+    Buffer raw = buf_new(chunk.raw_size);
+    // The chunk was already checked against its checksum, so this only fails if it was written incorrectly
+    if (UNLIKELY(!lz_decompress(&buf->data[buf->idx], chunk.size, raw.data, chunk.raw_size))) PANIC("Couldn't decompress column chunk");
+    raw.size = chunk.raw_size;
+    Values vals = readValues(&raw, type, chunk.rows, false, version, chunk.enc, heap);
+    buf_free(raw);
+    buf->idx += chunk.size;
+    return vals;
+}
+
+// Returns the string heap of the mapped file, checking it against its checksum the first time
+// Values appended by patchTabFile aren't part of the mapping, but they are never read from it either
+static String_View getHeap(Table *table)
+{
+    String_Heap *heap = &table->heap;
+    if (UNLIKELY(!heap->checked)) {
+        Column_Chunk chunk = { .off = heap->off, .size = heap->size, .crc = heap->crc };
+        if (UNLIKELY(!isChunkValid((u8*) table->map, table->map_size, chunk, table->version))) PANIC("The string heap is corrupted in its table file");
+        heap->checked = true;
+    }
+    return sv_from_parts(&table->map[heap->off], MIN(heap->size, table->map_size - heap->off));
+}
+
+// Returns the null-terminated path '<dir>/<name><ext>', or '<name><ext>' if dir is NULL
+static char* getTablePath(const char *dir, String_View name, const char *ext)
+{
+    u64 dirlen = dir == NULL ? 0 : strlen(dir) + 1;
+    u64 extlen = strlen(ext);
+    char *out  = malloc(dirlen + name.count + extlen + 1);
+    if (dir != NULL) {
+        memcpy(out, dir, dirlen - 1);
+        out[dirlen - 1] = '/';
+    }
+    memcpy(&out[dirlen], name.data, name.count);
+    memcpy(&out[dirlen + name.count], ext, extlen + 1);
+    return out;
+}
+
+// Returns the null-terminated path of a chunk's segment file (see Column_Chunk), relative to dir if it isn't NULL
+static char* getSegmentPath(const char *dir, String_View name, u32 id, i32 group, u64 gen)
+{
+    char ext[80];
+    if (group == 0) snprintf(ext, sizeof(ext), "/%u.%llu.col", id, (unsigned long long) gen);
+    else snprintf(ext, sizeof(ext), "/%u.%llu.%d.col", id, (unsigned long long) gen, group);
+    return getTablePath(dir, name, ext);
+}
+
+static void runParallelWorker(void *arg)
+{
+    Parallel_Work *work = arg;
+    while (true) {
+        util_lockMutex(&work->mutex);
+        i32 i = work->next++;
+        util_unlockMutex(&work->mutex);
+        if (i >= work->len) break;
+        work->fn(work->arg, i);
+    }
+}
+
+// Calls fn(arg, i) for every i below len, by up to one thread per core
+// The calling thread works on parts as well, so no thread is started for a single part
+static void runParallel(void (*fn)(void *arg, i32 idx), void *arg, i32 len)
+{
+    if (len <= 1) {
+        if (len == 1) fn(arg, 0);
+        return;
+    }
+    Parallel_Work work = { .fn = fn, .arg = arg, .len = len, .next = 0 };
+    util_initMutex(&work.mutex);
+    u32 threads_len = MIN(util_getCoreCount(), (u32) len) - 1;
+    util_Thread *threads = NULL;
+    for (u32 i = 0; i < threads_len; i++) {
+        util_Thread thread;
+        if (util_startThread(&thread, runParallelWorker, &work)) stbds_arrput(threads, thread);
+    }
+    runParallelWorker(&work);
+    for (i32 i = 0; i < stbds_arrlen(threads); i++) util_joinThread(threads[i]);
+    stbds_arrfree(threads);
+}
+
+static void runChunkReader(void *arg, i32 idx)
+{
+    Chunk_Reader *reader = arg;
+    Table        *table  = reader->table;
+    i32           c      = reader->cols[idx];
+    i32           g      = reader->groups[idx];
+    Column_Chunk  chunk  = table->blocks[c].chunks[g];
+    Datatype      type   = table->cols[c].type;
+    if (reader->segments) {
+        char  *filename = getSegmentPath(NULL, reader->name, table->blocks[c].id, g, chunk.gen);
+        Buffer buf      = buf_fromFile(filename);
+        // Segment files have no string heap, so their chunks can't be ENC_SLOT (see writeValues)
+        if (UNLIKELY(buf.size != chunk.size || chunk.enc == ENC_SLOT || !isChunkValid(buf.data, buf.size, chunk, table->version))) {
+            PANIC("Segment file '%s' is corrupted", filename);
+        }
+        reader->parts[idx] = readChunkValues(&buf, chunk, type, false, table->version, (String_View) {0});
+        buf_free(buf);
+        free(filename);
+        return;
+    }
+    if (UNLIKELY(!isChunkValid((u8*) table->map, table->map_size, chunk, table->version))) {
+        PANIC("Column '"SV_Fmt"' is corrupted in its table file", SV_Arg(table->cols[c].name));
+    }
+    String_View heap = chunk.enc == ENC_SLOT ? getHeap(table) : (String_View) {0};
+    Buffer buf = { .data = (u8*) table->map, .idx = chunk.off, .size = chunk.off + chunk.size, .cap = table->map_size };
+    reader->parts[idx] = readChunkValues(&buf, chunk, type, true, table->version, heap);
+}
+
+// Reads the values of the columns from their chunks, which are read and decoded in parallel (see runParallel)
+// The chunks are read from the mapped file, or from their segment files if `segments` is true,
+// which are assumed to be in the current working directory
+static void readChunks(String_View tablename, Table *table, const i32 *cols, i32 cols_len, bool segments)
+{
+    Chunk_Reader reader = { .name = tablename, .table = table, .segments = segments };
+    for (i32 i = 0; i < cols_len; i++) {
+        Column_Block block = table->blocks[cols[i]];
+        for (i32 g = 0; g < stbds_arrlen(block.chunks); g++) {
+            // The heap is checked before the threads are started, as that marks it as checked
+            if (!segments && block.chunks[g].enc == ENC_SLOT) getHeap(table);
+            stbds_arrput(reader.cols, cols[i]);
+            stbds_arrput(reader.groups, g);
+        }
+    }
+    i32 len = stbds_arrlen(reader.cols);
+    reader.parts = malloc(MAX(len, 1) * sizeof(Values));
+    runParallel(runChunkReader, &reader, len);
+    for (i32 i = 0, k = 0; i < cols_len; i++) {
+        i32 c   = cols[i];
+        i32 num = stbds_arrlen(table->blocks[c].chunks);
+        table->vals[c] = joinChunkValues(&reader.parts[k], num, table->cols[c].type, table->group_rows);
+        table->blocks[c].loaded = true;
+        // Options might have been added since the values were written
+        fitValuesToOpts(table->cols[c], &table->vals[c]);
+        k += num;
+    }
+    free(reader.parts);
+    stbds_arrfree(reader.cols);
+    stbds_arrfree(reader.groups);
+}
+
+// Returns the values of the column, reading them from the mapped file first if that didn't happen yet
+Values* getValues(Table *table, u32 colidx)
+{
+    if (UNLIKELY(!table->blocks[colidx].loaded)) {
+        i32 c = colidx;
+        readChunks((String_View) {0}, table, &c, 1, false);
+    }
+    padValues(&table->vals[colidx], table->cols[colidx].type, table->rows);
+    return &table->vals[colidx];
+}
+
+// Appends the indexes of the values in from..to, that the scan looks for, to rows. base is the row of the first value
+static void scanValues(Column_Scan *scan, Datatype type, Values vals, i32 from, i32 to, i32 base, u32 **rows)
+{
+    if (type == TYPE_SELECT) {
+        for (i32 i = from; i < to; i++) {
+            if (getSelect(vals.selects, i) == scan->from.select) stbds_arrput(*rows, base + i);
+        }
+        return;
+    }
+    i32 lo = getDateKey(scan->from.date);
+    i32 hi = getDateKey(scan->to.date);
+    for (i32 i = from; i < to; i++) {
+        i32 key = getDateKey(vals.dates[i]);
+        if (key >= lo && key <= hi && !isDateEmpty(vals.dates[i])) stbds_arrput(*rows, base + i);
+    }
+}
+
+// Scans one row group of the column
+// Chunks of columns that weren't loaded yet are scanned straight from the mapped file, so that the column stays unloaded
+// Run-length and delta-encoded chunks are evaluated on their runs and keys, without creating their values
+static void runColumnScan(void *arg, i32 idx)
+{
+    Column_Scan *scan  = arg;
+    Table       *table = scan->table;
+    Column_Block block = table->blocks[scan->colidx];
+    Datatype     type  = table->cols[scan->colidx].type;
+    u32        **rows  = &scan->rows[idx];
+    if (block.loaded) {
+        i32 start = idx * TAB_GROUP_ROWS;
+        scanValues(scan, type, table->vals[scan->colidx], start, MIN(start + TAB_GROUP_ROWS, table->rows), 0, rows);
+        return;
+    }
+    Column_Chunk chunk = block.chunks[idx];
+    i32 base = idx * table->group_rows;
+    if (!mayChunkMatch(type, chunk.stats, scan)) return;
+    if (UNLIKELY(!isChunkValid((u8*) table->map, table->map_size, chunk, table->version))) {
+        PANIC("Column '"SV_Fmt"' is corrupted in its table file", SV_Arg(table->cols[scan->colidx].name));
+    }
+    Buffer buf = { .data = (u8*) table->map, .idx = chunk.off, .size = chunk.off + chunk.size, .cap = table->map_size };
+    bool   raw = chunk.raw_size == chunk.size;
+    if (type == TYPE_SELECT && chunk.enc == ENC_RLE && raw) {
+        u32  stored = scan->from.select < 0 ? 0 : (u32) scan->from.select + 1;
+        u32 *values, *lens;
+        u8   bits;
+        u32  runs = readSelectRuns(&buf, chunk.rows, &bits, &values, &lens);
+        i32  row  = base;
+        for (u32 k = 0; k < runs; k++) {
+            if (values[k] == stored) {
+                u32 *dst = stbds_arraddnptr(*rows, lens[k]);
+                for (u32 j = 0; j < lens[k]; j++) dst[j] = row + j;
+            }
+            row += lens[k];
+        }
+        free(values);
+        free(lens);
+        return;
+    }
+    if (type == TYPE_DATE && chunk.enc == ENC_DELTA && raw) {
+        i32 lo    = getDateKey(scan->from.date);
+        i32 hi    = getDateKey(scan->to.date);
+        i32 *keys = malloc(chunk.rows * sizeof(i32));
+        readDeltaDateKeys(&buf, chunk.rows, keys);
+        for (i32 i = 0; i < chunk.rows; i++) {
+            if (keys[i] >= lo && keys[i] <= hi && !isDateEmpty(getDateFromKey(keys[i]))) stbds_arrput(*rows, base + i);
+        }
+        free(keys);
+        return;
+    }
+    Values vals = readChunkValues(&buf, chunk, type, true, table->version, (String_View) {0});
+    scanValues(scan, type, vals, 0, chunk.rows, base, rows);
+    freeValues(&vals, type);
+}
+
+// Returns a list of the indexes of all rows of a TYPE_SELECT or TYPE_DATE column, that have the values the scan looks for
+// The row groups are scanned in parallel (see runParallel). Chunks whose statistics rule out any match are skipped without reading them
+static u32* scanColumn(Table *table, u32 colidx, Value from, Value to)
+{
+    Column_Block block = table->blocks[colidx];
+    if (block.loaded) getValues(table, colidx);
+    i32 parts = block.loaded ? (table->rows + TAB_GROUP_ROWS - 1) / TAB_GROUP_ROWS : stbds_arrlen(block.chunks);
+    Column_Scan scan = { .table = table, .colidx = colidx, .from = from, .to = to, .rows = calloc(MAX(parts, 1), sizeof(u32*)) };
+    runParallel(runColumnScan, &scan, parts);
+    u32 *rows = NULL;
+    for (i32 i = 0; i < parts; i++) {
+        i32 len = stbds_arrlen(scan.rows[i]);
+        if (len > 0) memcpy(stbds_arraddnptr(rows, len), scan.rows[i], len * sizeof(u32));
+        stbds_arrfree(scan.rows[i]);
+    }
+    free(scan.rows);
+    // Rows added after the chunks were written have the default value
+    if (!block.loaded && parts > 0 && table->cols[colidx].type == TYPE_SELECT && from.select == VALUE_DEFAULT_SELECT) {
+        for (i32 row = (parts - 1) * table->group_rows + block.chunks[parts - 1].rows; row < table->rows; row++) stbds_arrput(rows, row);
+    }
+    return rows;
+}
+
+// Returns a list of the indexes of all rows whose value is val
+u32* filterSelectEq(Table *table, u32 colidx, Value_Select val)
+{
+    return scanColumn(table, colidx, (Value) { .select = val }, (Value) {0});
+}
+
+// Returns a list of the indexes of all rows whose date is between from and to (both inclusive). Empty dates never match
+u32* filterDateRange(Table *table, u32 colidx, Value_Date from, Value_Date to)
+{
+    return scanColumn(table, colidx, (Value) { .date = from }, (Value) { .date = to });
+}
+
+// The row group of the row in the table's file. Files before version 13 store all rows in one group
+static inline u32 getRowGroup(const Table *table, u32 rowidx)
+{
+    return table->group_rows == 0 ? 0 : rowidx / table->group_rows;
+}
+
+// Marks the row group of the row as changed, so that its chunk is written again by the next checkpoint (see writeTabFile)
+static void markRowDirty(Column_Block *block, u32 rowidx)
+{
+    u32 group = rowidx / TAB_GROUP_ROWS;
+    while ((u32) stbds_arrlen(block->dirty) <= group) stbds_arrput(block->dirty, false);
+    block->dirty[group] = true;
+}
+
+static inline bool isGroupDirty(Column_Block block, i32 group)
+{
+    return group < stbds_arrlen(block.dirty) && block.dirty[group];
+}
+
+static void freeBlock(Column_Block *block)
+{
+    stbds_arrfree(block->chunks);
+    stbds_arrfree(block->dirty);
+}
+
+// Returns a copy of the block, that doesn't share any memory with it
+static Column_Block copyBlock(Column_Block block)
+{
+    Column_Chunk *chunks = NULL;
+    bool         *dirty  = NULL;
+    if (stbds_arrlen(block.chunks) > 0) memcpy(stbds_arraddnptr(chunks, stbds_arrlen(block.chunks)), block.chunks, stbds_arrlen(block.chunks) * sizeof(Column_Chunk));
+    if (stbds_arrlen(block.dirty) > 0)  memcpy(stbds_arraddnptr(dirty, stbds_arrlen(block.dirty)), block.dirty, stbds_arrlen(block.dirty) * sizeof(bool));
+    block.chunks = chunks;
+    block.dirty  = dirty;
+    return block;
+}
+
+// The apply functions only change the table in memory. They are used by the CRUD functions below
+// and for replaying the write-ahead log, so they must not persist anything themselves
+
+bool applyAddColumn(Table *table, String_View name, Datatype type)
+{
+    if (UNLIKELY(type >= TYPE_LEN)) return false;
+    Column col = {0};
+    col.name = name;
+    col.type = type;
+    stbds_arrput(table->cols, col);
+    stbds_arrput(table->blocks, ((Column_Block){ .loaded = true, .id = table->next_col_id++ }));
+    // Filling the column with default values happens in getValues
+    stbds_arrput(table->vals, (Values){0});
+    return true;
+}
+
+bool applyRmColumn(Table *table, u32 colidx)
+{
+    if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) return false;
+    if (table->blocks[colidx].loaded) freeValues(&table->vals[colidx], table->cols[colidx].type);
+    freeBlock(&table->blocks[colidx]);
+    stbds_arrdel(table->vals, colidx);
+    stbds_arrdel(table->cols, colidx);
+    stbds_arrdel(table->blocks, colidx);
+    if (stbds_arrlen(table->cols) == 0) table->rows = 0;
+    return true;
+}
+
+bool applyRenameColumn(Table *table, u32 colidx, String_View newname)
+{
+    if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) return false;
+    // @Memory: The old name isn't freed, as it might not have been allocated by us (e.g. when created via sv_from_cstr)
+    table->cols[colidx].name = newname;
+    return true;
+}
+
+bool applyAddOpt(Table *table, u32 colidx, String_View sv)
+{
+    if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) return false;
+    Datatype type = table->cols[colidx].type;
+    if (UNLIKELY(type != TYPE_SELECT && type != TYPE_TAG)) return false;
+    stbds_arrput(table->cols[colidx].opts.strs, sv);
+    // Columns that weren't read from the file yet are adapted once they are loaded
+    if (table->blocks[colidx].loaded) fitValuesToOpts(table->cols[colidx], &table->vals[colidx]);
+    return true;
+}
+
+// Columns that weren't read from the file yet get the new row once they are loaded
+bool applyAddRow(Table *table)
+{
+    if (UNLIKELY(stbds_arrlen(table->cols) == 0)) return true;
+    table->rows += 1;
+    for (i32 i = 0; i < stbds_arrlen(table->cols); i++) {
+        if (table->blocks[i].loaded) padValues(&table->vals[i], table->cols[i].type, table->rows);
+    }
+    return true;
+}
+
+// The list of options of a TYPE_TAG value is copied, so the caller keeps owning it
+bool applySetValue(Table *table, u32 colidx, u32 rowidx, Value val)
+{
+    if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) return false;
+    if (UNLIKELY((u32) table->rows <= rowidx)) return false;
+    Column  col  = table->cols[colidx];
+    Values *vals = getValues(table, colidx);
+    markRowDirty(&table->blocks[colidx], rowidx);
+    switch (col.type)
+    {
+    case TYPE_STR:
+        // Copy-on-edit: The column is copied out of the mapped file on its first change
+        setStr(&vals->strs, rowidx, val.str);
+        break;
+    case TYPE_SELECT:
+        setSelect(&vals->selects, rowidx, val.select);
+        break;
+    case TYPE_TAG:
+        setTags(&vals->tags, rowidx, val.tag);
+        break;
+    case TYPE_DATE:
+        vals->dates[rowidx] = val.date;
+        break;
+    case TYPE_LEN:
+        PANIC("Cannot set a value for a column of type 'len'");
+    }
+    return true;
+}
+
+// Applies all records from one log file that aren't included in the table yet. Returns the valid size of the file
+// A torn record at the end of the log (e.g. after a crash while appending) is cut off
+static u64 replayWalFile(String_View tablename, Table *table, const char *ext)
+{
+    char *filename = getTablePath(NULL, tablename, ext);
+    Buffer buf = buf_fromFile(filename);
+    u64 valid = 0;
+    while (buf.idx + sizeof(u32) + sizeof(u64) + 1 <= buf.size) {
+        u32 size = buf_read4(&buf);
+        u64 end  = buf.idx + size;
+        if (UNLIKELY(size < sizeof(u64) + 1 || end > buf.size)) break;
+        u64    lsn = buf_read8(&buf);
+        Wal_Op op  = buf_read1(&buf);
+        if (lsn <= table->lsn) {
+            buf.idx = valid = end;
+            continue;
+        }
+        bool ok = false;
+        switch (op)
+        {
+        case WAL_OP_ADD_ROW:
+            ok = applyAddRow(table);
+            break;
+        case WAL_OP_SET_VALUE: {
+            u32 colidx = buf_read4(&buf);
+            u32 rowidx = buf_read4(&buf);
+            if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) break;
+            Value val = buf_readValue(&buf, table->cols[colidx].type);
+            ok = applySetValue(table, colidx, rowidx, val);
+            if (table->cols[colidx].type == TYPE_TAG) stbds_arrfree(val.tag);
+            break;
+        }
+        case WAL_OP_ADD_COLUMN: {
+            Datatype type = buf_read1(&buf);
+            ok = applyAddColumn(table, buf_readSV(&buf), type);
+            break;
+        }
+        case WAL_OP_RM_COLUMN:
+            ok = applyRmColumn(table, buf_read4(&buf));
+            break;
+        case WAL_OP_RENAME_COLUMN: {
+            u32 colidx = buf_read4(&buf);
+            ok = applyRenameColumn(table, colidx, buf_readSV(&buf));
+            break;
+        }
+        case WAL_OP_ADD_OPT: {
+            u32 colidx = buf_read4(&buf);
+            ok = applyAddOpt(table, colidx, buf_readSV(&buf));
+            break;
+        }
+        default:
+            break;
+        }
+        if (UNLIKELY(!ok || buf.idx != end)) {
+            printf("Stopped replaying write-ahead log of table '"SV_Fmt"' at invalid record with lsn %llu\n", SV_Arg(tablename), (unsigned long long) lsn);
+            break;
+        }
+        table->lsn = lsn;
+        valid      = end;
+    }
+    if (valid < buf.size) util_writeFile(filename, (char*) buf.data, valid);
+    buf_free(buf);
+    free(filename);
+    return valid;
+}
+
+// Applies all records from the write-ahead log that aren't included in the table yet
+// The log of a checkpoint that wasn't finished ('<name>.wal.old', see startCheckpoint) contains the older records
+void replayWal(String_View tablename, Table *table)
+{
+    table->wal_size  = replayWalFile(tablename, table, ".wal.old");
+    table->wal_size += replayWalFile(tablename, table, ".wal");
+}
+
+// With LOAD_MODE_MAP, the table's TYPE_STR values point into the mapped file instead of being copied
+// and columns are only read once they are accessed via getValues (if the file has a column directory)
+// Otherwise the file is streamed through a window of TAB_STREAM_WINDOW bytes column by column, so that it is
+// never held in memory as a whole in addition to its values. Files before version 8 are still read at once
+// Tables in the segmented layout are always read right away from their segment files (see readChunks)
+// Column names and options are always copied, as they are few and get freed/replaced independently
+Table readTabFile(String_View tablename, Load_Mode mode)
+{
+    char *filename = util_memadd(tablename.data, tablename.count, ".tab", 5);
+    Table  tab = {0};
+    Buffer buf = {0};
+    Buffer_Stream stream = {0};
+    bool streaming = false;
+    bool patching  = false;
+    Layout layout  = LAYOUT_SINGLE;
+    if (table_db != NULL) {
+        // Tables in the container point into the container's mapping
+        u64 size;
+        char *data = db_get(table_db, sv_from_parts(filename, tablename.count + 4), &size);
+        free(filename);
+        if (data == NULL) return (Table) {0};
+        if (mode == LOAD_MODE_MAP) {
+            // Dropped again by unloadTable
+            tab.map        = data;
+            tab.map_size   = size;
+            tab.map_shared = true;
+            buf = (Buffer) { .data = (u8*) data, .size = size, .cap = size };
+        } else {
+            buf = buf_new(size);
+            buf_writeBytes(&buf, data, size);
+            buf.idx = 0;
+            db_drop(table_db, data);
+        }
+    } else {
+        if (!FileExists(filename)) {
+            free(filename);
+            return (Table) {0};
+        }
+        // The program stopped while the file was being patched (see patchTabFile)
+        char *marker = getTablePath(NULL, tablename, ".tab.patch");
+        patching = FileExists(marker);
+        free(marker);
+        if (mode == LOAD_MODE_MAP) {
+            tab.map  = util_mapFile(filename, &tab.map_size);
+            buf.data = (u8*) tab.map;
+            buf.size = buf.cap = tab.map_size;
+        }
+        if (tab.map == NULL) {
+            streaming = buf_openStream(&stream, filename, TAB_STREAM_WINDOW);
+            if (UNLIKELY(!streaming)) PANIC("Couldn't open table file '%s'", filename);
+            // Everything up to the chunks is read first. Its size is only known since version 8
+            u64 meta_size = stream.file_size;
+            if (buf_fillStream(&stream, 0, TAB_HEADER_SIZE) && *((u32*)stream.buf.data) == TAB_MAGIC && ((u32*)stream.buf.data)[1] >= 8) {
+                meta_size = *((u64*)&stream.buf.data[2*sizeof(u32) + sizeof(u64)]);
+            }
+            if (UNLIKELY(!buf_fillStream(&stream, 0, meta_size))) PANIC("Table file '%s' is corrupted", filename);
+            buf = stream.buf;
+        }
+        free(filename);
+    }
+    tab.tab_size = streaming ? stream.file_size : buf.size;
+
+    // Files written before the write-ahead log was introduced don't have a header
+    if (buf.size >= sizeof(u32) && *((u32*)buf.data) == TAB_MAGIC) {
+        buf_read4(&buf);
+        tab.version = buf_read4(&buf);
+        if (UNLIKELY(tab.version > TAB_VERSION)) PANIC("Table file '"SV_Fmt".tab' has unknown version %u", SV_Arg(tablename), tab.version);
+        tab.lsn = buf_read8(&buf);
+    }
+    u64 meta_size = 0;
+    if (tab.version >= 8) {
+        // Everything up to the chunks is covered by a checksum at its end, so corrupted lengths are never read
+        meta_size = buf_read8(&buf);
+        if (UNLIKELY(meta_size < buf.idx + sizeof(u32) || meta_size > buf.size || meta_size > tab.tab_size ||
+                     (!patching && util_crc32c(0, buf.data, meta_size - sizeof(u32)) != *((u32*)&buf.data[meta_size - sizeof(u32)])))) {
+            PANIC("Table file '"SV_Fmt".tab' is corrupted", SV_Arg(tablename));
+        }
+    }
+    if (tab.version >= 10) {
+        Compression compression = buf_read1(&buf);
+        if (UNLIKELY(compression >= COMPRESSION_LEN)) PANIC("Unexpected compression '%d' in table file '"SV_Fmt".tab'", compression, SV_Arg(tablename));
+    }
+    if (tab.version >= 12) {
+        layout = buf_read1(&buf);
+        if (UNLIKELY(layout >= LAYOUT_LEN)) PANIC("Unexpected layout '%d' in table file '"SV_Fmt".tab'", layout, SV_Arg(tablename));
+        // Segmented tables are never patched, so a leftover marker doesn't excuse a corrupted manifest
+        if (layout == LAYOUT_SEGMENTS && patching) {
+            patching = false;
+            if (UNLIKELY(util_crc32c(0, buf.data, meta_size - sizeof(u32)) != *((u32*)&buf.data[meta_size - sizeof(u32)]))) {
+                PANIC("Table file '"SV_Fmt".tab' is corrupted", SV_Arg(tablename));
+            }
+        }
+    }
+    i32 colslen = buf_read4i(&buf);
+    stbds_arrsetlen(tab.cols, colslen);
+    stbds_arrsetlen(tab.vals, colslen);
+    stbds_arrsetlen(tab.blocks, colslen);
+    memset(tab.vals, 0, colslen * sizeof(Values));
+    for (i32 i = 0; i < colslen; i++) {
+        tab.cols[i] = buf_readColumn(&buf, tab.version >= 9);
+    }
+    tab.rows        = buf_read4i(&buf);
+    tab.next_col_id = tab.version >= 12 ? buf_read4(&buf) : (u32) colslen;
+    // Before version 13, each column was stored in one chunk
+    i32 groups = 1;
+    if (tab.version >= 13) {
+        tab.group_rows = buf_read4(&buf);
+        groups         = buf_read4i(&buf);
+        // Chunks are split at multiples of 64 rows, which the arithmetic on the words of bitsets relies on
+        bool bad_group_rows = groups > 1 && (tab.group_rows == 0 || tab.group_rows % 64 != 0);
+        if (UNLIKELY(groups < 1 || bad_group_rows || (u64) groups * colslen * TAB_DIR_ENTRY_SIZE > buf.size - buf.idx)) {
+            PANIC("Table file '"SV_Fmt".tab' is corrupted", SV_Arg(tablename));
+        }
+    }
+    for (i32 c = 0; c < colslen; c++) {
+        Column_Block block = { .loaded = false, .id = c };
+        if (tab.version >= 13) block.id = buf_read4(&buf);
+        for (i32 g = 0; g < groups; g++) {
+            Column_Chunk chunk = { .off = 0, .size = 0, .rows = tab.rows, .enc = ENC_PLAIN, .stats = CHUNK_STATS_ANY };
+            if (tab.version >= 2) {
+                chunk.off  = buf_read8(&buf);
+                chunk.size = buf_read8(&buf);
+            }
+            if (tab.version >= 4) {
+                chunk.enc = buf_read1(&buf);
+                if (UNLIKELY(chunk.enc >= ENC_LEN)) PANIC("Unexpected encoding '%d' in table file '"SV_Fmt".tab'", chunk.enc, SV_Arg(tablename));
+            }
+            if (tab.version >= 8) chunk.crc = buf_read4(&buf);
+            chunk.raw_size = tab.version >= 10 ? buf_read8(&buf) : chunk.size;
+            if (tab.version == 12) block.id = buf_read4(&buf);
+            if (tab.version >= 12) chunk.rows = buf_read4i(&buf);
+            if (tab.version >= 13) {
+                chunk.stats.mask = buf_read8(&buf);
+                chunk.stats.min  = buf_read4i(&buf);
+                chunk.stats.max  = buf_read4i(&buf);
+            }
+            if (layout == LAYOUT_SEGMENTS) {
+                // The offset is the generation of the segment file instead, as the chunk starts at its beginning
+                chunk.gen     = chunk.off;
+                chunk.off     = 0;
+                tab.tab_size += chunk.size;
+            }
+            stbds_arrput(block.chunks, chunk);
+        }
+        tab.blocks[c] = block;
+    }
+    if (tab.version >= 11) {
+        tab.heap.off     = buf_read8(&buf);
+        tab.heap.size    = buf_read8(&buf);
+        tab.heap.crc     = buf_read4(&buf);
+        tab.heap.garbage = buf_read8(&buf);
+    }
+    // Without a column directory, the columns can only be read one after another
+    // A partially patched file can't be verified, so it is read right away and rewritten with the next checkpoint
+    if (layout == LAYOUT_SEGMENTS) {
+        i32 *cols = malloc(MAX(colslen, 1) * sizeof(i32));
+        for (i32 c = 0; c < colslen; c++) cols[c] = c;
+        readChunks(tablename, &tab, cols, colslen, true);
+        free(cols);
+    } else if (tab.version < 2 || tab.map == NULL || patching) {
+        // The heap is read before the chunks, as streamed chunks replace each other in the window
+        String_View heap = {0};
+        char *heap_copy  = NULL;
+        bool  slots      = false;
+        for (i32 c = 0; c < colslen; c++) {
+            for (i32 g = 0; g < groups; g++) slots |= tab.blocks[c].chunks[g].enc == ENC_SLOT;
+        }
+        if (slots) {
+            Column_Chunk chunk = { .off = tab.heap.off, .size = tab.heap.size, .crc = tab.heap.crc };
+            // Values might have been appended to a partially patched file, that its metadata doesn't know about yet
+            if (patching && chunk.off <= tab.tab_size) chunk.size = tab.tab_size - chunk.off;
+            bool valid;
+            if (streaming) {
+                valid = buf_fillStream(&stream, chunk.off, chunk.size);
+                if (valid) {
+                    heap_copy = malloc(chunk.size);
+                    memcpy(heap_copy, &stream.buf.data[stream.buf.idx], chunk.size);
+                    valid = patching || util_crc32c(0, heap_copy, chunk.size) == chunk.crc;
+                }
+                heap = sv_from_parts(heap_copy, chunk.size);
+            } else {
+                valid = isChunkValid(buf.data, buf.size, chunk, patching ? 0 : tab.version);
+                heap  = sv_from_parts((char*) &buf.data[chunk.off], chunk.size);
+            }
+            if (UNLIKELY(!valid)) PANIC("The string heap is corrupted in table file '"SV_Fmt".tab'", SV_Arg(tablename));
+        }
+        Values *parts = malloc(groups * sizeof(Values));
+        for (i32 c = 0; c < colslen; c++) {
+            for (i32 g = 0; g < groups; g++) {
+                Column_Chunk chunk = tab.blocks[c].chunks[g];
+                if (tab.version >= 2) {
+                    if (streaming) {
+                        // Offsets in the window are relative to its start
+                        if (UNLIKELY(!buf_fillStream(&stream, chunk.off, chunk.size))) {
+                            PANIC("Column '"SV_Fmt"' is corrupted in table file '"SV_Fmt".tab'", SV_Arg(tab.cols[c].name), SV_Arg(tablename));
+                        }
+                        buf       = stream.buf;
+                        chunk.off = buf.idx;
+                    }
+                    if (UNLIKELY(!isChunkValid(buf.data, buf.size, chunk, patching ? 0 : tab.version))) {
+                        PANIC("Column '"SV_Fmt"' is corrupted in table file '"SV_Fmt".tab'", SV_Arg(tab.cols[c].name), SV_Arg(tablename));
+                    }
+                    buf.idx = chunk.off;
+                }
+                parts[g] = readChunkValues(&buf, chunk, tab.cols[c].type, tab.map != NULL, tab.version, heap);
+            }
+            tab.vals[c] = joinChunkValues(parts, groups, tab.cols[c].type, tab.group_rows);
+            tab.blocks[c].loaded = true;
+            fitValuesToOpts(tab.cols[c], &tab.vals[c]);
+        }
+        free(parts);
+        free(heap_copy);
+    }
+    if (streaming) buf_closeStream(&stream);
+    else if (tab.map == NULL) buf_free(buf);
+    if (layout == LAYOUT_SEGMENTS && tab.map != NULL && !tab.map_shared) {
+        // Nothing points into the manifest, as the values were copied out of the segment files
+        util_unmapFile(tab.map, tab.map_size);
+        tab.map      = NULL;
+        tab.map_size = 0;
+    }
+    replayWal(tablename, &tab);
+    tab.patchable = tab.map != NULL && !tab.map_shared && tab.version == TAB_VERSION && !patching && tab.wal_size == 0;
+    return tab;
+}
+
+#if defined(_WIN32)
+// Windows refuses to replace a file that is still mapped, so all columns are loaded
+// and the mapped strings are copied onto the heap before writing
+// Tables in the container don't need this, as the container never overwrites pages while they might be mapped
+static void unmapTable(Table *table)
+{
+    if (table->map == NULL || table->map_shared) return;
+    for (i32 c = 0; c < stbds_arrlen(table->cols); c++) {
+        Values *vals = getValues(table, c);
+        if (table->cols[c].type == TYPE_STR)    detachStrValues(&vals->strs);
+        if (table->cols[c].type == TYPE_SELECT) detachSelectValues(&vals->selects);
+        if (table->cols[c].type == TYPE_TAG)    detachTagValues(&vals->tags);
+    }
+    util_unmapFile(table->map, table->map_size);
+    table->map      = NULL;
+    table->map_size = 0;
+}
+#endif
+
+// Compresses the chunk, that was written into buf since off, if TAB_COMPRESS is set and that makes it smaller
+// Returns the size of the chunk before compressing it
+static u64 compressChunk(Buffer *buf, u64 off)
+{
+    u64 raw_size = buf_len(*buf) - off;
+    if (TAB_COMPRESS && raw_size > 0) {
+        // Chunks that don't get smaller are kept uncompressed
+        u8 *compressed = malloc(lz_bound(raw_size));
+        u64 size = lz_compress(&buf->data[off], raw_size, compressed);
+        if (size < raw_size) {
+            buf->idx = buf->size = off;
+            buf_writeBytes(buf, compressed, size);
+        }
+        free(compressed);
+    }
+    return raw_size;
+}
+
+// Continues the checksum of a '.tab' file, that covers its first `*end` bytes, with the chunk that starts at or after them
+// The bytes in between are the zeros, that chunks are aligned with. That way the checksum of the whole file is assembled
+// from the checksums of its parts and the file doesn't have to be read again
+static u32 appendChunkChecksum(u32 crc, u64 *end, Column_Chunk chunk)
+{
+    static const u8 zeros[sizeof(u64)] = {0};
+    crc  = util_crc32cCombine(crc, util_crc32c(0, zeros, chunk.off - *end), chunk.off - *end);
+    crc  = util_crc32cCombine(crc, chunk.crc, chunk.size);
+    *end = chunk.off + chunk.size;
+    return crc;
+}
+
+// Deletes all segment files in the table's directory, that none of the chunks refers to anymore
+// Those are the old files of rewritten chunks or removed columns and files of checkpoints, that failed before their manifest was written
+static void removeStaleSegments(const char *dir, String_View tablename, Column_Block *blocks, i32 len)
+{
+    char *segdir = getTablePath(dir, tablename, "");
+    if (DirectoryExists(segdir)) {
+        FilePathList files = LoadDirectoryFiles(segdir);
+        for (u32 i = 0; i < files.count; i++) {
+            const char *fname = GetFileName(files.paths[i]);
+            u64 fname_len = strlen(fname);
+            if (fname_len < 4 || strcmp(&fname[fname_len - 4], ".col") != 0) continue;
+            bool used = false;
+            for (i32 c = 0; c < len && !used; c++) {
+                for (i32 g = 0; g < stbds_arrlen(blocks[c].chunks) && !used; g++) {
+                    Column_Chunk chunk = blocks[c].chunks[g];
+                    char *path = getSegmentPath(NULL, sv_from_parts("", 0), blocks[c].id, g, chunk.gen);
+                    used = chunk.gen != 0 && strcmp(&path[1], fname) == 0;
+                    free(path);
+                }
+            }
+            if (!used) remove(files.paths[i]);
+        }
+        UnloadDirectoryFiles(files);
+    }
+    free(segdir);
+}
+
+// Whether '.tab' files are written in the segmented layout (see TAB_SEGMENTS)
+static inline bool isSegmented(void)
+{
+    return TAB_SEGMENTS && table_db == NULL;
+}
+
+// The file is written into dir, which may be NULL for the current working directory
+// Doesn't change the working directory, so it can be called from the checkpoint writer
+// Format of '.tab' files (version 13):
+// u32 magic, u32 version, u64 lsn, u64 metasize, u8 compression, u8 layout, i32 colslen, Column[colslen] (with varint lengths),
+// i32 rowslen, u32 next column id, u32 rows per row group, i32 groups, column directory: colslen * (u32 id, groups * (u64 offset,
+// u64 size, u8 encoding, u32 crc32c, u64 raw size, i32 rows, u64 select mask, i32 min date key, i32 max date key (see Chunk_Stats))),
+// string heap: u64 offset, u64 size, u32 crc32c, u64 garbage, u32 crc32c of the first metasize-4 bytes,
+// followed by the chunks of each column (see writeValues) and the string heap. The checksum of a chunk is computed after compressing it
+// Chunks of row groups that didn't change since the mapped file was written are copied over without reading or encoding them again
+// In the container, the file is stored under the same name as in the data directory, but the caller has to commit it
+// (see commitContainer), so that several tables can be committed together
+// Unless the chunks are compressed or the file goes into the container, the file is gathered (see buf_newGather):
+// Arrays of the values, copied chunks and the values in the heap are written straight from memory with writev, instead of
+// being copied into one buffer first. Only the metadata and small encoded parts of the chunks are copied
+// With TAB_SEGMENTS, only the metadata is written into the '.tab' file. The chunks that changed since their segment file
+// was written are written into new segment files, whose generation is stored as their offset (see Column_Chunk)
+bool writeTabFile(String_View tablename, Table *tablep, char *dir)
+{
+#if defined(_WIN32)
+    unmapTable(tablep);
+#endif
+    STATIC_ASSERT(TAB_GROUP_ROWS % 64 == 0);
+    Table table    = *tablep;
+    i32  colslen   = stbds_arrlen(table.cols);
+    i32  groups    = MAX((table.rows + TAB_GROUP_ROWS - 1) / TAB_GROUP_ROWS, 1);
+    bool segmented = isSegmented();
+    bool gather    = !TAB_COMPRESS && table_db == NULL;
+    Buffer buf  = gather ? buf_newGather(4096) : buf_new(64 * 1024);
+    Buffer heap = gather ? buf_newGather(1024) : buf_new(1024);
+    buf_write4(&buf, TAB_MAGIC);
+    buf_write4(&buf, TAB_VERSION);
+    buf_write8(&buf, table.lsn);
+    u64 meta_size_idx = buf.idx;
+    buf_write8(&buf, 0);
+    u64 compression_idx = buf.idx;
+    buf_write1(&buf, COMPRESSION_NONE);
+    buf_write1(&buf, segmented ? LAYOUT_SEGMENTS : LAYOUT_SINGLE);
+    buf_write4i(&buf, colslen);
+    for (i32 i = 0; i < colslen; i++) {
+        buf_writeColumn(&buf, table.cols[i], true);
+    }
+    buf_write4i(&buf, table.rows);
+    buf_write4(&buf, table.next_col_id);
+    buf_write4(&buf, TAB_GROUP_ROWS);
+    buf_write4i(&buf, groups);
+    u64 dir_idx = buf.idx;
+    for (i32 i = 0; i < colslen; i++) {
+        buf_write4(&buf, table.blocks[i].id);
+        for (i32 g = 0; g < groups; g++) {
+            buf_write8(&buf, 0);
+            buf_write8(&buf, 0);
+            buf_write1(&buf, 0);
+            buf_write4(&buf, 0);
+            buf_write8(&buf, 0);
+            buf_write4i(&buf, 0);
+            buf_write8(&buf, 0);
+            buf_write4i(&buf, 0);
+            buf_write4i(&buf, 0);
+        }
+    }
+    u64 heap_idx = buf.idx;
+    buf_write8(&buf, 0);
+    buf_write8(&buf, 0);
+    buf_write4(&buf, 0);
+    buf_write8(&buf, 0);
+    u64 meta_size = buf.idx + sizeof(u32);
+    *((u64*)(&buf.data[meta_size_idx])) = meta_size;
+    buf_write4(&buf, 0);
+
+    bool out = true;
+    u64  segs_size = 0;
+    Column_Chunk *chunks = calloc(colslen * groups, sizeof(Column_Chunk));
+    if (segmented) {
+        char *segdir = getTablePath(dir, tablename, "");
+        if (!DirectoryExists(segdir)) mkdir(segdir);
+        free(segdir);
+    }
+    for (i32 i = 0; i < colslen && out; i++) {
+        Column_Block block = table.blocks[i];
+        Datatype     type  = table.cols[i].type;
+        for (i32 g = 0; g < groups && out; g++) {
+            i32 start = g * TAB_GROUP_ROWS;
+            i32 rows  = MIN(TAB_GROUP_ROWS, table.rows - start);
+            // Whether the chunk, that the values of the row group were read from, still has the same values
+            bool unchanged = table.group_rows == TAB_GROUP_ROWS && g < stbds_arrlen(block.chunks) && block.chunks[g].rows == rows && !isGroupDirty(block, g);
+            Column_Chunk chunk;
+            if (segmented) {
+                if (unchanged && block.chunks[g].gen != 0) {
+                    // Unchanged chunks keep their segment file
+                    chunk = block.chunks[g];
+                } else {
+                    Values slice = sliceValues(*getValues(tablep, i), type, start, rows);
+                    Buffer seg   = gather ? buf_newGather(4096) : buf_new(4096);
+                    chunk.enc      = writeValues(&seg, type, slice, rows, NULL);
+                    chunk.raw_size = compressChunk(&seg, 0);
+                    chunk.off      = 0;
+                    chunk.size     = buf_len(seg);
+                    chunk.gen      = table.lsn + 1;
+                    chunk.rows     = rows;
+                    chunk.crc      = buf_crc32c(0, &seg, 0);
+                    chunk.stats    = getChunkStats(type, slice, rows);
+                    char *segname = getSegmentPath(dir, tablename, block.id, g, chunk.gen);
+                    out = buf_toFile(&seg, segname);
+                    free(segname);
+                }
+                segs_size += chunk.size;
+            } else {
+                // Chunks are 8-byte aligned, so the arrays inside them can be used straight from the mapped file
+                while (buf_len(buf) % sizeof(u64) != 0) buf_write1(&buf, 0);
+                u64 off = buf_len(buf);
+                // Their checksum is kept instead of being recomputed, so that a corrupted chunk stays detectable
+                // Slots are always rewritten, as the heap is rebuilt without its garbage
+                if (unchanged && table.map != NULL && table.version == TAB_VERSION && block.chunks[g].enc != ENC_SLOT) {
+                    chunk = block.chunks[g];
+                    buf_writeRef(&buf, &table.map[chunk.off], chunk.size);
+                } else {
+                    Values slice = sliceValues(*getValues(tablep, i), type, start, rows);
+                    chunk.enc      = writeValues(&buf, type, slice, rows, &heap);
+                    chunk.raw_size = compressChunk(&buf, off);
+                    chunk.gen      = 0;
+                    chunk.rows     = rows;
+                    chunk.crc      = buf_crc32c(0, &buf, off);
+                    chunk.stats    = getChunkStats(type, slice, rows);
+                }
+                chunk.off  = off;
+                chunk.size = buf_len(buf) - off;
+            }
+            chunks[i*groups + g] = chunk;
+            if (chunk.raw_size != chunk.size) buf.data[compression_idx] = COMPRESSION_LZ;
+            u8 *entry = &buf.data[dir_idx + i*(sizeof(u32) + groups*TAB_DIR_ENTRY_SIZE) + sizeof(u32) + g*TAB_DIR_ENTRY_SIZE];
+            *((u64*)(&entry[0]))                                  = segmented ? chunk.gen : chunk.off;
+            *((u64*)(&entry[sizeof(u64)]))                        = chunk.size;
+            entry[2*sizeof(u64)]                                  = chunk.enc;
+            *((u32*)(&entry[2*sizeof(u64) + 1]))                  = chunk.crc;
+            *((u64*)(&entry[2*sizeof(u64) + 1 + sizeof(u32)]))    = chunk.raw_size;
+            *((i32*)(&entry[3*sizeof(u64) + 1 + sizeof(u32)]))    = chunk.rows;
+            *((u64*)(&entry[3*sizeof(u64) + 1 + 2*sizeof(u32)]))  = chunk.stats.mask;
+            *((i32*)(&entry[4*sizeof(u64) + 1 + 2*sizeof(u32)]))  = chunk.stats.min;
+            *((i32*)(&entry[4*sizeof(u64) + 1 + 3*sizeof(u32)]))  = chunk.stats.max;
+        }
+    }
+    while (buf_len(buf) % sizeof(u64) != 0) buf_write1(&buf, 0);
+    // The metadata comes before any memory, that buf references, so it can still be changed via buf.data
+    Column_Chunk heap_chunk = { .off = buf_len(buf), .size = buf_len(heap), .crc = buf_crc32c(0, &heap, 0) };
+    u8 *entry = &buf.data[heap_idx];
+    *((u64*)(&entry[0]))             = heap_chunk.off;
+    *((u64*)(&entry[sizeof(u64)]))   = heap_chunk.size;
+    *((u32*)(&entry[2*sizeof(u64)])) = heap_chunk.crc;
+    buf_writeBuffer(&buf, &heap);
+    *((u32*)(&buf.data[meta_size - sizeof(u32)])) = util_crc32c(0, buf.data, meta_size - sizeof(u32));
+
+    // The file is written to a temporary file first and then swapped in, since the old file might still be mapped
+    // In the segmented layout, swapping in the manifest switches over to the new segment files at once
+    char *filename = getTablePath(dir, tablename, ".tab");
+    char *tmpname  = getTablePath(dir, tablename, ".tab.tmp");
+    u64  size = buf_len(buf);
+    u64  end  = meta_size;
+    u32  crc  = util_crc32c(0, buf.data, meta_size);
+    for (i32 i = 0; i < colslen * groups && !segmented; i++) crc = appendChunkChecksum(crc, &end, chunks[i]);
+    crc = appendChunkChecksum(crc, &end, heap_chunk);
+    if (!out) {
+        buf_free(buf);
+    } else if (table_db != NULL) {
+        // readTabFile looks the blob up by its bare name, no matter which directory dir is
+        char *blobname = getTablePath(NULL, tablename, ".tab");
+        out = db_put(table_db, sv_from_cstr(blobname), buf.data, buf.size);
+        free(blobname);
+        buf_free(buf);
+    } else {
+        out = buf_toFile(&buf, tmpname) && util_replaceFile(tmpname, filename);
+    }
+    buf_free(heap);
+    if (out) {
+        tablep->tab_size     = size + segs_size;
+        tablep->tab_checksum = crc;
+        // The mapped file was replaced, so it can't be patched anymore. A partially patched file was replaced as well
+        tablep->patchable    = false;
+        stbds_arrfree(tablep->patches);
+        char *marker = getTablePath(dir, tablename, ".tab.patch");
+        remove(marker);
+        free(marker);
+        // The chunks of the single layout keep describing the mapped file, that their values are read from
+        if (segmented) {
+            for (i32 i = 0; i < colslen; i++) {
+                Column_Block *block = &tablep->blocks[i];
+                stbds_arrsetlen(block->chunks, groups);
+                memcpy(block->chunks, &chunks[i*groups], groups * sizeof(Column_Chunk));
+                stbds_arrfree(block->dirty);
+            }
+            tablep->group_rows = TAB_GROUP_ROWS;
+        }
+        if (table_db == NULL) removeStaleSegments(dir, tablename, tablep->blocks, colslen);
+    }
+    free(chunks);
+    free(filename);
+    free(tmpname);
+    return out;
+}
+
+// Makes the '.tab' files, that writeTabFile put into the container since the last commit, visible at once
+static bool commitContainer(void)
 {
-    char *filename = util_memadd(tablename.data, tablename.count, ".tab", 5);
-    if (!FileExists(filename)) return (Table) {0};
-    Buffer buf = buf_fromFile(filename);
+    return table_db == NULL || db_commit(table_db);
+}
+
+// Whether the table's '.tab' file exists where readTabFile looks for it, once the working directory is dir
+static bool hasTabFile(const char *dir, String_View tablename)
+{
+    char *filename = getTablePath(table_db != NULL ? NULL : dir, tablename, ".tab");
+    bool  out      = table_db != NULL ? db_has(table_db, sv_from_cstr(filename)) : FileExists(filename);
     free(filename);
+    return out;
+}
 
-    Table tab = { .cols = NULL, .vals = NULL };
-    i32 colslen = buf_read4i(&buf);
-    stbds_arrsetlen(tab.cols, colslen);
-    stbds_arrsetlen(tab.vals, colslen);
-    memset(tab.vals, 0, colslen * sizeof(Values));
-    for (i32 i = 0; i < colslen; i++) {
-        tab.cols[i] = buf_readColumn(&buf);
-    }
-    i32 rowslen = buf_read4i(&buf);
+// Copies everything the checkpoint writer needs, so that the live table can keep being changed while the copy is written
+// Columns that weren't loaded yet aren't copied, as the mapped file they are read from is never changed
+static Table snapshotTable(Table *table)
+{
+    i32 colslen = stbds_arrlen(table->cols);
+    Table snap  = *table;
+    snap.cols   = NULL;
+    snap.vals   = NULL;
+    snap.blocks = NULL;
+    snap.wal_pending = NULL;
+    snap.patches     = NULL;
+    stbds_arrsetlen(snap.cols,   colslen);
+    stbds_arrsetlen(snap.vals,   colslen);
+    stbds_arrsetlen(snap.blocks, colslen);
     for (i32 c = 0; c < colslen; c++) {
-        switch (tab.cols[c].type)
-        {
-        case TYPE_STR:
-            stbds_arrsetcap(tab.vals[c].strs, rowslen);
-            for (i32 r = 0; r < rowslen; r++) {
-                Value_Str sv = buf_readSV(&buf);
-                stbds_arrput(tab.vals[c].strs, sv);
-            }
-            break;
-        case TYPE_SELECT:
-            stbds_arrsetcap(tab.vals[c].selects, rowslen);
-            for (i32 r = 0; r < rowslen; r++) {
-                Value_Select idx = buf_read4i(&buf);
-                stbds_arrput(tab.vals[c].selects, idx);
-            }
-            break;
-        case TYPE_TAG:
-            stbds_arrsetcap(tab.vals[c].tags, rowslen);
-            for (i32 r = 0; r < rowslen; r++) {
-                Value_Tag tag = NULL;
-                i32 amount    = buf_read4i(&buf);
-                stbds_arrsetcap(tag, amount);
-                for (i32 k = 0; k < amount; k++) {
-                    i32 idx = buf_read4i(&buf);
-                    stbds_arrput(tag, idx);
+        Column col = table->cols[c];
+        String_View *opts = NULL;
+        if (stbds_arrlen(col.opts.strs) > 0) memcpy(stbds_arraddnptr(opts, stbds_arrlen(col.opts.strs)), col.opts.strs, stbds_arrlen(col.opts.strs) * sizeof(String_View));
+        col.opts.strs   = opts;
+        snap.cols[c]    = col;
+        snap.blocks[c]  = copyBlock(table->blocks[c]);
+        snap.vals[c]    = table->blocks[c].loaded ? copyValues(*getValues(table, c), col.type) : (Values){0};
+    }
+    return snap;
+}
+
+// Only frees what snapshotTable copied. The mapped file and the column names are still used by the live table
+// The blocks are kept, as they are handed back to the live table with the checkpoint's result (see applySegments)
+static void freeSnapshot(Table *snap)
+{
+    for (i32 c = 0; c < stbds_arrlen(snap->cols); c++) {
+        stbds_arrfree(snap->cols[c].opts.strs);
+        if (snap->blocks[c].loaded) freeValues(&snap->vals[c], snap->cols[c].type);
+    }
+    stbds_arrfree(snap->cols);
+    stbds_arrfree(snap->vals);
+}
+
+static void runCheckpointWriter(void *arg)
+{
+    Checkpoint_Writer *writer = arg;
+    util_lockMutex(&writer->mutex);
+    while (true) {
+        while (stbds_arrlen(writer->jobs) == 0 && !writer->stop) util_waitCond(&writer->cond, &writer->mutex);
+        if (stbds_arrlen(writer->jobs) == 0) break;
+        Checkpoint_Job job = writer->jobs[0];
+        util_unlockMutex(&writer->mutex);
+
+        // The old log is only needed until the '.tab' file includes its records and can be read back from where it is looked for
+        bool ok = writeTabFile(job.name, &job.table, job.dir) && commitContainer() && hasTabFile(job.dir, job.name);
+        if (ok) {
+            char *oldname = getTablePath(job.dir, job.name, ".wal.old");
+            remove(oldname);
+            free(oldname);
+        }
+        Checkpoint_Result result = { .name = job.name, .tab_size = job.table.tab_size, .checksum = job.table.tab_checksum, .blocks = job.table.blocks, .ok = ok };
+        freeSnapshot(&job.table);
+        free(job.dir);
+
+        util_lockMutex(&writer->mutex);
+        stbds_arrdel(writer->jobs, 0);
+        stbds_arrput(writer->results, result);
+        util_broadcastCond(&writer->cond);
+    }
+    util_unlockMutex(&writer->mutex);
+}
+
+static bool isCheckpointQueued(String_View tablename)
+{
+    Checkpoint_Writer *writer = &checkpoint_writer;
+    if (!writer->started) return false;
+    bool out = false;
+    util_lockMutex(&writer->mutex);
+    for (i32 i = 0; i < stbds_arrlen(writer->jobs) && !out; i++) out = sv_eq(writer->jobs[i].name, tablename);
+    util_unlockMutex(&writer->mutex);
+    return out;
+}
+
+// Updates the tables with the results of finished checkpoints. Must be called from the UI thread
+// Takes over the segment files, that were written for a snapshot of the table (see writeTabFile)
+// Blocks are matched by their id, as columns might have been added or removed since the snapshot was taken
+// Segment files older than the ones the table knows about are ignored, as they were replaced by a later checkpoint
+// If the checkpoint failed, the row groups that changed before the snapshot are marked as changed again
+static void applySegments(Table *table, Column_Block *blocks, bool ok)
+{
+    for (i32 i = 0; i < stbds_arrlen(blocks); i++) {
+        for (i32 c = 0; c < stbds_arrlen(table->blocks); c++) {
+            Column_Block *block = &table->blocks[c];
+            if (block->id != blocks[i].id) continue;
+            if (ok) {
+                for (i32 g = 0; g < stbds_arrlen(blocks[i].chunks); g++) {
+                    Column_Chunk chunk = blocks[i].chunks[g];
+                    if (chunk.gen == 0) continue;
+                    if (g >= stbds_arrlen(block->chunks)) stbds_arrput(block->chunks, chunk);
+                    else if (chunk.gen >= block->chunks[g].gen) block->chunks[g] = chunk;
                 }
-                stbds_arrput(tab.vals[c].tags, tag);
             }
-            break;
-        case TYPE_DATE:
-            stbds_arrsetcap(tab.vals[c].dates, rowslen);
-            for (i32 r = 0; r < rowslen; r++) {
-                u8  d = buf_read1(&buf);
-                u8  m = buf_read1(&buf);
-                u16 y = buf_read2(&buf);
-                Value_Date date = { .day = d, .month = m, .year = y };
-                stbds_arrput(tab.vals[c].dates, date);
+            if (!ok) {
+                for (i32 g = 0; g < stbds_arrlen(blocks[i].dirty); g++) {
+                    if (blocks[i].dirty[g]) markRowDirty(block, g * TAB_GROUP_ROWS);
+                }
             }
-            break;
-        default:
-            PANIC("Unexpected column type '%d' in reading table file %s", tab.cols[c].type, tablename.data);
         }
     }
-    buf_free(buf);
-    return tab;
+    if (ok && isSegmented()) table->group_rows = TAB_GROUP_ROWS;
 }
 
-bool writeTabFile(String_View tablename, Table table, char *dir)
+void collectCheckpoints(Table_Defs td)
 {
-    i32 colslen = stbds_arrlen(table.cols);
-    Buffer buf  = buf_new(64 * 1028);
-    buf_write4i(&buf, colslen);
-    for (i32 i = 0; i < colslen; i++) {
-        buf_writeColumn(&buf, table.cols[i]);
-    }
-    i32 rowslen     = 0;
-    u64 rowslen_idx = buf.idx;
-    buf_write4i(&buf, rowslen);
-    if (UNLIKELY(table.vals != NULL)) {
-        for (i32 i = 0; i < colslen; i++) {
-            Values col = table.vals[i];
-            switch (table.cols[i].type)
-            {
-            case TYPE_STR:
-                rowslen = stbds_arrlen(col.strs);
-                for (i32 j = 0; j < rowslen; j++) {
-                    Value_Str sv = col.strs[j];
-                    buf_writeStr(&buf, sv.data, sv.count);
-                }
-                break;
+    Checkpoint_Writer *writer = &checkpoint_writer;
+    if (!writer->started) return;
+    util_lockMutex(&writer->mutex);
+    for (i32 i = 0; i < stbds_arrlen(writer->results); i++) {
+        Checkpoint_Result result = writer->results[i];
+        for (i32 t = 0; t < stbds_arrlen(td.names); t++) {
+            if (!sv_eq(td.names[t], result.name)) continue;
+            applySegments(&td.tabs[t], result.blocks, result.ok);
+            if (!result.ok) continue;
+            td.tabs[t].tab_size     = result.tab_size;
+            td.tabs[t].tab_checksum = result.checksum;
+            def_file_dirty = true;
+        }
+        if (!result.ok) printf("Failed to checkpoint table '"SV_Fmt"'\n", SV_Arg(result.name));
+        for (i32 c = 0; c < stbds_arrlen(result.blocks); c++) freeBlock(&result.blocks[c]);
+        stbds_arrfree(result.blocks);
+        free(result.name.data);
+    }
+    stbds_arrsetlen(writer->results, 0);
+    util_unlockMutex(&writer->mutex);
+}
 
-            case TYPE_SELECT:
-                rowslen = stbds_arrlen(col.selects);
-                for (i32 j = 0; j < rowslen; j++) {
-                    Value_Select idx = col.selects[j];
-                    buf_write4i(&buf, idx);
-                }
-                break;
+// Waits until all queued checkpoints were written
+void finishCheckpoints(void)
+{
+    Checkpoint_Writer *writer = &checkpoint_writer;
+    if (!writer->started) return;
+    util_lockMutex(&writer->mutex);
+    while (stbds_arrlen(writer->jobs) > 0) util_waitCond(&writer->cond, &writer->mutex);
+    util_unlockMutex(&writer->mutex);
+}
 
-            case TYPE_TAG:
-                rowslen = stbds_arrlen(col.tags);
-                for (i32 j = 0; j < rowslen; j++) {
-                    Value_Tag tags = col.tags[j];
-                    i32 tagslen    = stbds_arrlen(tags);
-                    buf_write4i(&buf, tagslen);
-                    for (i32 k = 0; k < tagslen; k++) {
-                        buf_write4i(&buf, tags[k]);
-                    }
-                }
-                break;
+// Writes all queued checkpoints and stops the writer's thread. Should be called before the program exits
+void stopCheckpointWriter(void)
+{
+    Checkpoint_Writer *writer = &checkpoint_writer;
+    if (!writer->started) return;
+    util_lockMutex(&writer->mutex);
+    writer->stop = true;
+    util_broadcastCond(&writer->cond);
+    util_unlockMutex(&writer->mutex);
+    util_joinThread(writer->thread);
+    writer->started = false;
+    writer->stop    = false;
+}
 
-            case TYPE_DATE:
-                rowslen = stbds_arrlen(col.dates);
-                for (i32 j = 0; j < rowslen; j++) {
-                    Value_Date date = col.dates[j];
-                    buf_write1(&buf, date.day);
-                    buf_write1(&buf, date.month);
-                    buf_write2(&buf, date.year);
-                }
-                break;
-            default:
-                PANIC("Unexpected column type '%d' in writing table '%s'", table.cols[i].type, tablename.data);
-            }
+// Queues a checkpoint of the table, that is written in the background. The table's files must be in the current working directory
+// The write-ahead log is moved to '<name>.wal.old', which is deleted once the '.tab' file was written, and new mutations are logged into a new file
+// Only one checkpoint per table is queued at a time, further calls are ignored until it was written
+bool startCheckpoint(String_View tablename, Table *table)
+{
+    Checkpoint_Writer *writer = &checkpoint_writer;
+    if (isCheckpointQueued(tablename)) return true;
+#if defined(_WIN32)
+    // The writer can't replace the '.tab' file while it is mapped
+    unmapTable(table);
+#endif
+    char *walname = getTablePath(NULL, tablename, ".wal");
+    char *oldname = getTablePath(NULL, tablename, ".wal.old");
+    bool  ok;
+    if (FileExists(oldname)) {
+        // A previous checkpoint failed, so its old log is still needed
+        Buffer wal = buf_fromFile(walname);
+        ok = util_appendFile(oldname, (char*) wal.data, wal.size) && util_writeFile(walname, NULL, 0);
+        buf_free(wal);
+    } else {
+        ok = !FileExists(walname) || rename(walname, oldname) == 0;
+    }
+    free(walname);
+    free(oldname);
+    if (UNLIKELY(!ok)) return false;
+    table->wal_size  = 0;
+    // The '.tab' file is about to be replaced
+    table->patchable = false;
+    stbds_arrfree(table->patches);
+
+    Checkpoint_Job job = {
+        .dir   = getcwd(NULL, 0),
+        .name  = sv_from_parts(util_memadd(tablename.data, tablename.count, "", 1), tablename.count),
+        .table = snapshotTable(table),
+    };
+    // The checkpoint writes the changed row groups into segment files from now on (see applySegments)
+    // In the single layout, the chunks keep describing the mapped file, so the changes since it was written are kept
+    if (isSegmented()) {
+        for (i32 c = 0; c < stbds_arrlen(table->blocks); c++) stbds_arrfree(table->blocks[c].dirty);
+    }
+    if (!writer->started) {
+        util_initMutex(&writer->mutex);
+        util_initCond(&writer->cond);
+        writer->started = util_startThread(&writer->thread, runCheckpointWriter, writer);
+    }
+    if (UNLIKELY(!writer->started)) {
+        // Without a background thread, the checkpoint is written right away
+        bool out = writeTabFile(job.name, &job.table, NULL) && commitContainer();
+        applySegments(table, job.table.blocks, out);
+        if (out) {
+            table->tab_size     = job.table.tab_size;
+            table->tab_checksum = job.table.tab_checksum;
+            oldname = getTablePath(NULL, tablename, ".wal.old");
+            remove(oldname);
+            free(oldname);
         }
-        *((i32*)(&buf.data[rowslen_idx])) = rowslen;
+        for (i32 c = 0; c < stbds_arrlen(job.table.blocks); c++) freeBlock(&job.table.blocks[c]);
+        stbds_arrfree(job.table.blocks);
+        freeSnapshot(&job.table);
+        free(job.dir);
+        free(job.name.data);
+        return out;
     }
+    util_lockMutex(&writer->mutex);
+    stbds_arrput(writer->jobs, job);
+    util_broadcastCond(&writer->cond);
+    util_unlockMutex(&writer->mutex);
+    return true;
+}
 
-    if (dir != NULL) chdir(dir);
-    char *filename = util_memadd(tablename.data, tablename.count, ".tab", 5);
-    bool out = buf_toFile(&buf, filename);
+// Rewrites the '.tab' file to include all mutations and empties the write-ahead log right away
+// If the program crashes in between, replaying the log skips all records already included in the '.tab' file
+// Empties the table's write-ahead log, once the '.tab' file includes all of its records
+static bool resetWal(String_View tablename, Table *table, char *dir)
+{
+    char *filename = getTablePath(dir, tablename, ".wal");
+    char *oldname  = getTablePath(dir, tablename, ".wal.old");
+    bool out = util_writeFile(filename, NULL, 0);
+    remove(oldname);
+    free(filename);
+    free(oldname);
+    if (out) {
+        // Pending records are included in the '.tab' file already
+        table->wal_size = 0;
+        stbds_arrsetlen(table->wal_pending, 0);
+        table->wal_pending_records = 0;
+    }
+    return out;
+}
+
+bool checkpointTable(String_View tablename, Table *table, char *dir)
+{
+    // Queued checkpoints of the same table must not overwrite this one afterwards
+    finishCheckpoints();
+    return writeTabFile(tablename, table, dir) && commitContainer() && resetWal(tablename, table, dir);
+}
+
+// Starts a record for the table's write-ahead log. Should only be called after the mutation was applied successfully
+static Buffer beginWalRecord(Table *table, Wal_Op op, u64 payload_size)
+{
+    table->lsn += 1;
+    Buffer rec = buf_new(sizeof(u32) + sizeof(u64) + 1 + payload_size);
+    buf_write4(&rec, 0); // Size is filled in by logMutation
+    buf_write8(&rec, table->lsn);
+    buf_write1(&rec, op);
+    return rec;
+}
+
+static int compareU64(const void *a, const void *b)
+{
+    u64 x = *(const u64*) a;
+    u64 y = *(const u64*) b;
+    return (x > y) - (x < y);
+}
+
+// Whether the differences before and after the row of a delta-encoded TYPE_DATE chunk still fit into its width (see writeDeltaDates)
+// `dates` starts at the chunk's first row and `local` is relative to it
+static bool fitsDeltaDates(const char *chunk, const Value_Date *dates, i32 rows, u32 local)
+{
+    i32 min   = *((i32*) &chunk[sizeof(i32)]);
+    u64 width = *((u64*) &chunk[2*sizeof(i32)]);
+    if (dates[local].day >= 32 || dates[local].month >= 16) return false;
+    for (u32 i = MAX(local, 1); i <= local + 1 && i < (u32) rows; i++) {
+        i64 val = (i64) getDateKey(dates[i]) - getDateKey(dates[i - 1]) - min;
+        if (val < 0 || (u64) val >> width != 0) return false;
+    }
+    return true;
+}
+
+// Writes the changed date of the row into a delta-encoded TYPE_DATE chunk (see writeDeltaDates): the first key, if it is the first row,
+// and the words, that hold the differences before and after it. Assumes those to fit into the chunk's width (see fitsDeltaDates)
+static bool patchDeltaDate(int fd, Column_Chunk chunk, const char *map, const Value_Date *dates, u32 local)
+{
+    i32 min   = *((i32*) &map[chunk.off + sizeof(i32)]);
+    u8  width = *((u64*) &map[chunk.off + 2*sizeof(i32)]);
+    u64 words = chunk.off + 2*sizeof(i32) + sizeof(u64);
+    i32 key   = getDateKey(dates[0]);
+    if (local == 0 && !util_writeAt(fd, chunk.off, &key, sizeof(i32))) return false;
+    if (width == 0) return true;
+    // Difference i is the one between the rows i and i+1
+    u64 first = (u64) (local == 0 ? 0 : local - 1) * width / 64;
+    u64 last  = ((u64) MIN(local, (u32) chunk.rows - 2) * width + width - 1) / 64;
+    for (u64 w = first; w <= last; w++) {
+        u64 word = packDeltaDateWord(dates, chunk.rows, min, width, w);
+        if (!util_writeAt(fd, words + w*sizeof(u64), &word, sizeof(u64))) return false;
+    }
+    return true;
+}
+
+// Whether the cell can be written straight into the table's mapped '.tab' file
+// That's the case for TYPE_SELECT and TYPE_DATE columns in the plain layout, as each of their values has a fixed place in the file,
+// for delta-encoded TYPE_DATE columns, as long as the changed differences still fit into their width,
+// and for TYPE_STR columns in the slotted layout, whose values are appended to the string heap
+static bool isCellPatchable(Table *table, u32 colidx, u32 rowidx)
+{
+    Column_Block block = table->blocks[colidx];
+    u32 group = getRowGroup(table, rowidx);
+    if (!block.loaded || group >= (u32) stbds_arrlen(block.chunks)) return false;
+    Column_Chunk chunk = block.chunks[group];
+    rowidx -= group * table->group_rows;
+    if (rowidx >= (u32) chunk.rows || chunk.raw_size != chunk.size) return false;
+    switch (table->cols[colidx].type)
+    {
+    case TYPE_STR:
+        return chunk.enc == ENC_SLOT;
+    case TYPE_DATE:
+        {
+        const Value_Date *dates = &table->vals[colidx].dates[group * table->group_rows];
+        if (chunk.enc == ENC_DELTA) return fitsDeltaDates(&table->map[chunk.off], dates, chunk.rows, rowidx);
+        return chunk.enc == ENC_PLAIN;
+        }
+    case TYPE_SELECT:
+        {
+        if (chunk.enc != ENC_PLAIN) return false;
+        // The amount of bits per value might have grown since the chunk was written
+        u64 bits = table->vals[colidx].selects.bits;
+        u64 word = rowidx / (64 / bits);
+        return bits == *((u64*) &table->map[chunk.off]) && (word + 2)*sizeof(u64) <= chunk.size;
+        }
+    default:
+        return false;
+    }
+}
+
+// Writes the cells changed since the '.tab' file was read straight into the file, instead of rewriting all of it,
+// so that the I/O only depends on the amount of changed cells. Then the write-ahead log is emptied
+// Only possible while the file is still the mapped one and only patchable cells (see isCellPatchable) were changed
+// The cells are written and synced as one batch, followed by the updated metadata (lsn and checksums) as another one
+// Changed strings are appended to the string heap and their old values become garbage. Once the garbage makes up half of the heap,
+// the table isn't patched anymore, so that the next checkpoint rewrites the file without it in the background
+// While patching, the marker file '<name>.tab.patch' exists. If the program stops in between, readTabFile doesn't verify
+// the partially patched file, as replaying the write-ahead log (which is only emptied afterwards) restores all cells anyway
+// Assumes the table's files to be in the current working directory and all of its records to be in the write-ahead log
+static bool patchTabFile(String_View tablename, Table *table)
+{
+    if (!table->patchable || table->wal_pending_records > 0 || isCheckpointQueued(tablename)) return false;
+    u64 *patches = table->patches;
+    u64  len     = stbds_arrlen(patches);
+    for (u64 i = 0; i < len; i++) {
+        if (!isCellPatchable(table, patches[i] >> 32, (u32) patches[i])) return false;
+    }
+    // Appended strings mustn't be checked against the heap's checksum later on, as they aren't part of the mapping
+    getHeap(table);
+    qsort(patches, len, sizeof(u64), compareU64);
+
+    i32   colslen  = stbds_arrlen(table->cols);
+    i32   groups   = colslen > 0 ? stbds_arrlen(table->blocks[0].chunks) : 0;
+    bool *touched  = calloc(colslen * groups, sizeof(bool));
+    char *filename = getTablePath(NULL, tablename, ".tab");
+    char *marker   = getTablePath(NULL, tablename, ".tab.patch");
+    String_Heap heap = table->heap;
+    // The marker has to be on disk before the first cell is written
+    int   fd       = open(marker, O_WRONLY | O_CREAT | O_BINARY, 0777);
+    bool  ok       = fd != -1 && util_syncFile(fd);
+    if (fd != -1) close(fd);
+    fd = ok ? open(filename, O_RDWR | O_BINARY, 0777) : -1;
+    ok = fd != -1;
+    for (u64 i = 0; ok && i < len; i++) {
+        if (i > 0 && patches[i] == patches[i - 1]) continue;
+        u32 c     = patches[i] >> 32;
+        u32 row   = (u32) patches[i];
+        u32 group = getRowGroup(table, row);
+        // Offsets into the chunk are relative to its first row, while the values in memory span all row groups
+        u32 local = row - group * table->group_rows;
+        Column_Chunk *chunk = &table->blocks[c].chunks[group];
+        Values       *vals  = &table->vals[c];
+        touched[c*groups + group] = true;
+        if (table->cols[c].type == TYPE_STR) {
+            // Same layout as in writeSlotStrs
+            String_View sv = getStr(vals->strs, row);
+            u64 off        = sv.count == 0 ? 0 : heap.size;
+            u32 count      = sv.count;
+            u32 old_count;
+            u64 slot_off   = chunk->off + local*sizeof(u64);
+            u64 len_off    = chunk->off + chunk->rows*sizeof(u64) + local*sizeof(u32);
+            ok = util_readAt(fd, len_off, &old_count, sizeof(u32)) && util_writeAt(fd, heap.off + heap.size, sv.data, sv.count) &&
+                 util_writeAt(fd, slot_off, &off, sizeof(u64)) && util_writeAt(fd, len_off, &count, sizeof(u32));
+            heap.crc      = util_crc32cCombine(heap.crc, util_crc32c(0, sv.data, sv.count), sv.count);
+            heap.size    += sv.count;
+            heap.garbage += old_count;
+        } else if (table->cols[c].type == TYPE_SELECT) {
+            // Row groups are a multiple of 64 rows, so their words never straddle two chunks
+            u64 per_word = 64 / vals->selects.bits;
+            u64 word     = row / per_word;
+            u64 first    = group * table->group_rows / per_word;
+            ok = util_writeAt(fd, chunk->off + sizeof(u64) + (word - first)*sizeof(u64), &vals->selects.words[word], sizeof(u64));
+            widenChunkStats(&chunk->stats, TYPE_SELECT, *vals, row);
+        } else if (chunk->enc == ENC_DELTA) {
+            ok = patchDeltaDate(fd, *chunk, table->map, &vals->dates[group * table->group_rows], local);
+            widenChunkStats(&chunk->stats, TYPE_DATE, *vals, row);
+        } else {
+            ok = util_writeAt(fd, chunk->off + local*sizeof(Value_Date), &vals->dates[row], sizeof(Value_Date));
+            widenChunkStats(&chunk->stats, TYPE_DATE, *vals, row);
+        }
+    }
+    ok = ok && util_syncFile(fd);
+
+    // The metadata only differs in the lsn, the size of the heap and the checksums and statistics of the changed chunks
+    u64 meta_size = *((u64*) &table->map[2*sizeof(u32) + sizeof(u64)]);
+    u8 *meta      = malloc(meta_size);
+    memcpy(meta, table->map, meta_size);
+    *((u64*) &meta[2*sizeof(u32)]) = table->lsn;
+    u64 col_size = sizeof(u32) + groups*TAB_DIR_ENTRY_SIZE;
+    u64 heap_idx = meta_size - sizeof(u32) - TAB_HEAP_ENTRY_SIZE;
+    u64 dir_idx  = heap_idx - colslen*col_size;
+    for (i32 i = 0; ok && i < colslen * groups; i++) {
+        if (!touched[i]) continue;
+        i32 c = i / groups;
+        i32 g = i % groups;
+        Column_Chunk *chunk = &table->blocks[c].chunks[g];
+        Values       *vals  = &table->vals[c];
+        if (table->cols[c].type == TYPE_STR) {
+            // The slots aren't kept in memory, so they are read back
+            u8 *slots  = malloc(chunk->size);
+            ok         = util_readAt(fd, chunk->off, slots, chunk->size);
+            chunk->crc = util_crc32c(0, slots, chunk->size);
+            free(slots);
+        } else if (table->cols[c].type == TYPE_SELECT) {
+            // Same layout as in writeValues
+            u64 bits   = vals->selects.bits;
+            u64 first  = g * table->group_rows / (64 / bits);
+            chunk->crc = util_crc32c(0, &bits, sizeof(u64));
+            chunk->crc = util_crc32c(chunk->crc, &vals->selects.words[first], chunk->size - sizeof(u64));
+        } else if (chunk->enc == ENC_DELTA) {
+            // Encoded again with the chunk's width, which is the same layout as the patched chunk
+            Buffer enc = buf_new(chunk->size);
+            writeDeltaDatesWith(&enc, &vals->dates[g * table->group_rows], chunk->rows,
+                                *((i32*) &table->map[chunk->off + sizeof(i32)]), *((u64*) &table->map[chunk->off + 2*sizeof(i32)]));
+            chunk->crc = util_crc32c(0, enc.data, enc.size);
+            buf_free(enc);
+        } else {
+            chunk->crc = util_crc32c(0, &vals->dates[g * table->group_rows], chunk->size);
+        }
+        u8 *entry = &meta[dir_idx + c*col_size + sizeof(u32) + g*TAB_DIR_ENTRY_SIZE];
+        *((u32*) &entry[2*sizeof(u64) + 1])                 = chunk->crc;
+        *((u64*) &entry[3*sizeof(u64) + 1 + 2*sizeof(u32)]) = chunk->stats.mask;
+        *((i32*) &entry[4*sizeof(u64) + 1 + 2*sizeof(u32)]) = chunk->stats.min;
+        *((i32*) &entry[4*sizeof(u64) + 1 + 3*sizeof(u32)]) = chunk->stats.max;
+    }
+    *((u64*) &meta[heap_idx + sizeof(u64)])                 = heap.size;
+    *((u32*) &meta[heap_idx + 2*sizeof(u64)])               = heap.crc;
+    *((u64*) &meta[heap_idx + 2*sizeof(u64) + sizeof(u32)]) = heap.garbage;
+    u32 meta_crc = util_crc32c(0, meta, meta_size - sizeof(u32));
+    *((u32*) &meta[meta_size - sizeof(u32)]) = meta_crc;
+    ok = ok && util_writeAt(fd, 0, meta, meta_size) && util_syncFile(fd);
+    if (fd != -1) close(fd);
+
+    if (ok) {
+        // The checksum of the whole file is assembled from the checksums of its parts, so the file doesn't have to be read again
+        u32 crc = util_crc32c(0, meta, meta_size);
+        u64 end = meta_size;
+        for (i32 i = 0; i < colslen * groups; i++) crc = appendChunkChecksum(crc, &end, table->blocks[i / groups].chunks[i % groups]);
+        crc = appendChunkChecksum(crc, &end, (Column_Chunk) { .off = heap.off, .size = heap.size, .crc = heap.crc });
+        table->tab_checksum = crc;
+        table->tab_size     = end;
+        table->heap         = heap;
+        char *walname = getTablePath(NULL, tablename, ".wal");
+        ok = util_writeFile(walname, NULL, 0);
+        free(walname);
+    }
+    if (ok) {
+        remove(marker);
+        table->wal_size  = 0;
+        table->patchable = heap.garbage <= heap.size / 2;
+        stbds_arrsetlen(table->patches, 0);
+    } else {
+        // The marker is kept until the file is rewritten, as it might be partially patched
+        table->patchable = false;
+    }
+    free(meta);
+    free(touched);
+    free(filename);
+    free(marker);
+    return ok;
+}
+
+// Appends the table's pending records to its write-ahead log with a single write
+// Once the log grew bigger than a quarter of the '.tab' file, a checkpoint of the table gets queued,
+// so that the cost of rewriting the whole table is amortized over many edits and doesn't block the UI
+// Assumes the table's files to be in the current working directory
+static bool flushWal(String_View tablename, Table *table)
+{
+    if (table->wal_pending_records == 0) return true;
+    char *filename = getTablePath(NULL, tablename, ".wal");
+    u64  size = stbds_arrlen(table->wal_pending);
+    bool out  = util_appendFile(filename, (char*) table->wal_pending, size);
     free(filename);
-    if (dir != NULL) chdir("..");
+    // The records stay pending if they couldn't be written, so that they are retried with the next flush
+    if (UNLIKELY(!out)) return false;
+    stbds_arrsetlen(table->wal_pending, 0);
+    table->wal_pending_records = 0;
+    table->wal_size += size;
+    // The table's metadata in tables.def changed
+    def_file_dirty = true;
+    if (table->wal_size >= MAX(WAL_CHECKPOINT_MIN_SIZE, table->tab_size/4)) out = patchTabFile(tablename, table) || startCheckpoint(tablename, table);
+    return out;
+}
+
+// Adds the record to the table's pending records and frees it
+// Pending records are appended to the write-ahead log together, once there are WAL_GROUP_MAX_RECORDS of them,
+// or by tickPersistence once the oldest one waited for WAL_GROUP_MAX_DELAY_MS, so that bursts of edits only cost one write
+bool logMutation(Table_Defs td, u32 tdidx, Buffer *rec)
+{
+    Table *table = &td.tabs[tdidx];
+    *((u32*)rec->data) = rec->size - sizeof(u32);
+    // Only changes of single cells can be patched into the '.tab' file (see patchTabFile)
+    if (rec->data[sizeof(u32) + sizeof(u64)] != WAL_OP_SET_VALUE) table->patchable = false;
+    if (table->wal_pending_records == 0) table->wal_pending_since = util_getMillis();
+    table->mtime = time(NULL);
+    memcpy(stbds_arraddnptr(table->wal_pending, rec->size), rec->data, rec->size);
+    table->wal_pending_records += 1;
+    buf_free(*rec);
+    if (table->wal_pending_records < WAL_GROUP_MAX_RECORDS) return true;
+    chdir("./data");
+    bool out = flushWal(td.names[tdidx], table);
+    chdir("..");
     return out;
 }
 
+static void runTableLoader(void *arg)
+{
+    Table_Loader *loader = arg;
+    while (true) {
+        util_lockMutex(&loader->mutex);
+        i32 i = loader->next++;
+        util_unlockMutex(&loader->mutex);
+        if (i >= loader->len) break;
+        if (loader->tabs[i].loaded) continue;
+        Table *table = &loader->tabs[i];
+        *table = readTabFile(loader->names[i], LOAD_MODE_MAP);
+        table->loaded       = true;
+        table->last_access  = util_getMillis();
+        table->tab_checksum = loader->infos[i].checksum;
+        table->mtime        = loader->infos[i].mtime;
+    }
+}
+
 // Assumes that the file under the path fpath exists and can be read from
-// Assumes all '.tab' files to be in the current directory
+// The tables aren't read yet. This happens once they are accessed via getTable (or all at once via loadAllTables)
+// Until then, their metadata is available via getTableInfo
 Table_Defs readDefFile(const char *fpath)
 {
-    Buffer buf = buf_fromFile(fpath);
-    Table_Defs td = { .names = NULL, .tabs = NULL };
+    Buffer buf = {0};
+    if (table_db != NULL) {
+        u64 size;
+        char *data = db_get(table_db, sv_from_cstr((char*) fpath), &size);
+        buf = buf_new(size);
+        buf_writeBytes(&buf, data, size);
+        buf.idx = 0;
+        db_drop(table_db, data);
+    } else {
+        buf = buf_fromFile(fpath);
+    }
+    Table_Defs td = { .names = NULL, .tabs = NULL, .infos = NULL };
 
+    // Before version 1, the file only contained the names of the tables without a header
+    u32 version = 0;
+    if (buf.size >= sizeof(u32) && *((u32*)buf.data) == TD_MAGIC) {
+        buf_read4(&buf);
+        version = buf_read4(&buf);
+        if (UNLIKELY(version > TD_VERSION)) PANIC("Catalog file '%s' has unknown version %u", fpath, version);
+    }
     while (buf_iter_cond(buf)) {
         String_View name = buf_readSV(&buf);
-        Table table = readTabFile(name);
-        stbds_arrput(td.tabs, table);
+        Table_Info  info = { .rows = -1, .cols = -1 };
+        if (version >= 1) {
+            info.rows     = buf_read4i(&buf);
+            info.cols     = buf_read4i(&buf);
+            info.size     = buf_read8(&buf);
+            info.checksum = buf_read4(&buf);
+            info.mtime    = buf_read8i(&buf);
+        }
         stbds_arrput(td.names, name);
+        stbds_arrput(td.infos, info);
+        stbds_arrput(td.tabs, (Table){0});
     }
 
     buf_free(buf);
     return td;
 }
 
-// If `write_tables` is true, it writes the '.tab' files for each table in td into the current working directory
+// Reads all tables that weren't loaded yet, in parallel by one thread per core
+// Assumes all '.tab' files to be in the current directory
+void loadAllTables(Table_Defs td)
+{
+    i32 len = stbds_arrlen(td.names);
+    Table_Loader loader = { .names = td.names, .tabs = td.tabs, .infos = td.infos, .len = len, .next = 0 };
+    util_initMutex(&loader.mutex);
+    // The calling thread loads tables as well, so only the additional threads are started
+    u32 threads_len = MIN(util_getCoreCount(), (u32) MAX(len, 1)) - 1;
+    util_Thread *threads = NULL;
+    for (u32 i = 0; i < threads_len; i++) {
+        util_Thread thread;
+        if (util_startThread(&thread, runTableLoader, &loader)) stbds_arrput(threads, thread);
+    }
+    runTableLoader(&loader);
+    for (i32 i = 0; i < stbds_arrlen(threads); i++) util_joinThread(threads[i]);
+    stbds_arrfree(threads);
+}
+
+// Returns the table, reading it from its files first if that didn't happen yet
+Table* getTable(Table_Defs td, u32 tdidx)
+{
+    Table *table = &td.tabs[tdidx];
+    if (UNLIKELY(!table->loaded)) {
+        chdir("./data");
+        *table = readTabFile(td.names[tdidx], LOAD_MODE_MAP);
+        chdir("..");
+        table->loaded       = true;
+        table->tab_checksum = td.infos[tdidx].checksum;
+        table->mtime        = td.infos[tdidx].mtime;
+    }
+    table->last_access = util_getMillis();
+    return table;
+}
+
+// Metadata of loaded tables is taken from the table itself, as tables.def might not have been written since it changed
+Table_Info getTableInfo(Table_Defs td, u32 tdidx)
+{
+    Table *table = &td.tabs[tdidx];
+    if (!table->loaded) return td.infos[tdidx];
+    return (Table_Info) {
+        .rows     = table->rows,
+        .cols     = stbds_arrlen(table->cols),
+        .size     = table->tab_size + table->wal_size + stbds_arrlen(table->wal_pending),
+        .checksum = table->tab_checksum,
+        .mtime    = table->mtime,
+    };
+}
+
+// Frees everything the table allocated, so that it can be read from its files again
+// @Memory: Column names and options aren't freed, as they might not have been allocated by us (e.g. when created via sv_from_cstr)
+static void unloadTable(Table *table)
+{
+    for (i32 c = 0; c < stbds_arrlen(table->cols); c++) {
+        if (table->blocks[c].loaded) freeValues(&table->vals[c], table->cols[c].type);
+        freeBlock(&table->blocks[c]);
+        stbds_arrfree(table->cols[c].opts.strs);
+    }
+    stbds_arrfree(table->cols);
+    stbds_arrfree(table->vals);
+    stbds_arrfree(table->blocks);
+    stbds_arrfree(table->wal_pending);
+    stbds_arrfree(table->patches);
+    if (table->map_shared) db_drop(table_db, table->map);
+    else util_unmapFile(table->map, table->map_size);
+    *table = (Table) {0};
+}
+
+// Unloads all tables that weren't accessed for max_idle milliseconds
+// Tables with pending records or a queued checkpoint (whose snapshot still uses the table's mapping) are kept
+void evictTables(Table_Defs td, u64 max_idle)
+{
+    u64 now = util_getMillis();
+    for (i32 i = 0; i < stbds_arrlen(td.tabs); i++) {
+        Table *table = &td.tabs[i];
+        if (!table->loaded || now - table->last_access < max_idle) continue;
+        if (table->wal_pending_records > 0 || isCheckpointQueued(td.names[i])) continue;
+        td.infos[i] = getTableInfo(td, i);
+        unloadTable(table);
+    }
+}
+
+// If `write_tables` is true, it checkpoints the '.tab' files for each table in td into the current working directory
 // To write everything into the same directory, you should therefore change into that directory first before calling this function
+// In the container, the '.tab' files are committed together with tables.def, so that they never get out of sync.
+// The write-ahead logs are only emptied once everything was written
+// Format of tables.def (version 1):
+// u32 magic, u32 version, for each table: String name, i32 rows, i32 cols, u64 size, u32 checksum, i64 mtime (see Table_Info)
 bool writeDefFile(const char *fpath, Table_Defs td, bool write_tables)
 {
-    u64 size = 0;
+    const u64 entry_size = sizeof(u64) + 2*sizeof(i32) + sizeof(u64) + sizeof(u32) + sizeof(i64);
+    u64 size = 2*sizeof(u32);
     i32 len  = stbds_arrlen(td.names);
     for (i32 i = 0; i < len; i++) {
-        size += 1 + td.names[i].count;
+        size += entry_size + td.names[i].count;
     }
+    // Queued checkpoints must not overwrite the tables afterwards
+    if (write_tables) finishCheckpoints();
     Buffer buf = buf_new(size);
+    buf_write4(&buf, TD_MAGIC);
+    buf_write4(&buf, TD_VERSION);
     for (i32 i = 0; i < len; i++) {
         String_View name = td.names[i];
+        // Tables that weren't loaded didn't change since they were written
+        if (write_tables && td.tabs[i].loaded && !writeTabFile(name, &td.tabs[i], NULL)) {
+            buf_free(buf);
+            return false;
+        }
+
+        Table_Info info = getTableInfo(td, i);
+        td.infos[i] = info;
         buf_writeStr(&buf, name.data, name.count);
+        buf_write4i(&buf, info.rows);
+        buf_write4i(&buf, info.cols);
+        buf_write8(&buf, info.size);
+        buf_write4(&buf, info.checksum);
+        buf_write8i(&buf, info.mtime);
+    }
+    bool out;
+    if (table_db != NULL) {
+        out = db_put(table_db, sv_from_cstr((char*) fpath), buf.data, buf.size) && db_commit(table_db);
+        buf_free(buf);
+    } else {
+        out = buf_toFile(&buf, fpath);
+    }
+    for (i32 i = 0; i < len && write_tables && out; i++) {
+        if (td.tabs[i].loaded) out = resetWal(td.names[i], &td.tabs[i], NULL);
+    }
+    return out;
+}
+
+bool hasDefFile(const char *fpath)
+{
+    return table_db != NULL ? db_has(table_db, sv_from_cstr((char*) fpath)) : FileExists(fpath);
+}
 
-        if (write_tables && !writeTabFile(name, td.tabs[i], NULL)) return false;
+// Stores tables.def and all '.tab' files in the single-file container at path (see db.h) instead of separate files
+// The write-ahead logs stay separate files, as they are appended to with every flush
+// The path must be absolute, as the working directory changes while the container is used
+bool useContainer(const char *path)
+{
+    Db *db = malloc(sizeof(Db));
+    if (!db_open(db, path)) {
+        free(db);
+        return false;
     }
-    return buf_toFile(&buf, fpath);
+    table_db = db;
+    return true;
 }
 
-i32 getTableRowsLen(Table table)
+// Flushes the pending records of all tables (or only of those whose oldest record waited long enough, if `all` is false)
+// and rewrites tables.def, if a table was added or changed since it was written last
+static bool flushPending(Table_Defs td, bool all)
 {
-    if (UNLIKELY(stbds_arrlen(table.vals)) == 0) return 0;
-    switch (table.cols[0].type)
-    {
-    case TYPE_STR:
-        return stbds_arrlen(table.vals[0].strs);
-    case TYPE_SELECT:
-        return stbds_arrlen(table.vals[0].selects);
-    case TYPE_TAG:
-        return stbds_arrlen(table.vals[0].tags);
-    case TYPE_DATE:
-        return stbds_arrlen(table.vals[0].dates);
-    case TYPE_LEN:
-        PANIC("Received illegal column type 'len'");
+    collectCheckpoints(td);
+    u64  now = util_getMillis();
+    bool out = true;
+    chdir("./data");
+    for (i32 i = 0; i < stbds_arrlen(td.tabs); i++) {
+        Table *table = &td.tabs[i];
+        if (table->wal_pending_records == 0) continue;
+        if (all || now - table->wal_pending_since >= WAL_GROUP_MAX_DELAY_MS) out = flushWal(td.names[i], table) && out;
     }
-    return 0;
+    if (def_file_dirty) {
+        def_file_dirty = !writeDefFile(TD_FILENAME, td, false);
+        out = out && !def_file_dirty;
+    }
+    chdir("..");
+    return out;
+}
+
+// Should be called regularly (e.g. once per frame) to write mutations, that waited long enough
+bool tickPersistence(Table_Defs td)
+{
+    return flushPending(td, false);
+}
+
+// Writes all pending mutations. Should be called before the program exits
+bool flushPersistence(Table_Defs td)
+{
+    return flushPending(td, true);
 }
 
 Table newTable(Table_Defs *td, String_View name)
 {
-    Table out = {0};
+    Table out = { .loaded = true, .mtime = time(NULL) };
     stbds_arrsetcap(out.cols, 16);
     stbds_arrsetcap(out.cols, 32);
     stbds_arrput(td->names, name);
     stbds_arrput(td->tabs,  out);
-    // Save new table
+    stbds_arrput(td->infos, ((Table_Info){ .mtime = out.mtime }));
+    // Save new table. Checkpointing also removes a stale write-ahead log of a previous table with the same name
+    // tables.def is only rewritten by the next flush, so that creating several tables at once only writes it once
     chdir("./data");
-    writeTabFile(name, out, NULL);
-    writeDefFile(TD_FILENAME, *td, false);
+    checkpointTable(name, &stbds_arrlast(td->tabs), NULL);
     chdir("..");
-    return out;
+    def_file_dirty = true;
+    return stbds_arrlast(td->tabs);
 }
 
 bool addColumn(Table_Defs td, u32 tdidx, String_View name, Datatype type)
 {
     if (UNLIKELY(stbds_arrlen((td).tabs) <= (tdidx))) return false;
-    Table *table = &(td).tabs[(tdidx)];
-    i32 rowslen = getTableRowsLen(*table);
-    Column col = {0};
-    col.name = name;
-    col.type = type;
-    stbds_arrput(table->cols, col);
-
-    // Fill column in all rows with default value
-    if (rowslen > 0) {
-        Values vals = {0};
-        switch (type)
-        {
-        case TYPE_STR:
-            stbds_arrsetlen(vals.strs, rowslen);
-            memset(vals.strs, VALUE_DEFAULT_STR, rowslen * sizeof(Value_Str));
-            break;
-        case TYPE_SELECT:
-            stbds_arrsetlen(vals.selects, rowslen);
-            memset(vals.selects, VALUE_DEFAULT_SELECT, rowslen * sizeof(Value_Select));
-            break;
-        case TYPE_TAG:
-            stbds_arrsetlen(vals.tags, rowslen);
-            memset(vals.tags, VALUE_DEFAULT_TAG, rowslen * sizeof(Value_Tag));
-            break;
-        case TYPE_DATE:
-            stbds_arrsetlen(vals.dates, rowslen);
-            memset(vals.dates, VALUE_DEFAULT_DATE, rowslen * sizeof(Value_Date));
-            break;
-        case TYPE_LEN:
-            PANIC("Cannot add a column of type 'len'");
-        }
-        stbds_arrput(table->vals, vals);
-    } else {
-        stbds_arrput(table->vals, (Values){0});
-    }
-    return writeTabFile(td.names[tdidx], *table, "./data");
+    Table *table = getTable(td, tdidx);
+    if (UNLIKELY(!applyAddColumn(table, name, type))) return false;
+    Buffer rec = beginWalRecord(table, WAL_OP_ADD_COLUMN, 1 + sizeof(u64) + name.count);
+    buf_write1(&rec, type);
+    buf_writeStr(&rec, name.data, name.count);
+    return logMutation(td, tdidx, &rec);
 }
 
 bool rmColumn(Table_Defs td, u32 tdidx, u32 colidx)
 {
     if (UNLIKELY(stbds_arrlen((td).tabs) <= (tdidx))) return false;
-    Table *table = &(td).tabs[(tdidx)];
-    if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) return false;
-
-    // @Memory: This is probably leaking memory. I probably have to go through each row and manually free everything there -_-
-    stbds_arrdel(table->vals, colidx);
-    stbds_arrdel(table->cols, colidx);
-    return writeTabFile(td.names[tdidx], *table, "./data");
+    Table *table = getTable(td, tdidx);
+    if (UNLIKELY(!applyRmColumn(table, colidx))) return false;
+    Buffer rec = beginWalRecord(table, WAL_OP_RM_COLUMN, sizeof(u32));
+    buf_write4(&rec, colidx);
+    return logMutation(td, tdidx, &rec);
 }
 
 bool renameColumn(Table_Defs td, u32 tdidx, u32 colidx, String_View newname)
 {
     if (UNLIKELY(stbds_arrlen((td).tabs) <= (tdidx))) return false;
-    Table *table = &(td).tabs[(tdidx)];
-    if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) return false;
-    Column col = table->cols[colidx];
-    free(col.name.data);
-    col.name = newname;
-    return writeTabFile(td.names[tdidx], *table, "./data");
+    Table *table = getTable(td, tdidx);
+    if (UNLIKELY(!applyRenameColumn(table, colidx, newname))) return false;
+    Buffer rec = beginWalRecord(table, WAL_OP_RENAME_COLUMN, sizeof(u32) + sizeof(u64) + newname.count);
+    buf_write4(&rec, colidx);
+    buf_writeStr(&rec, newname.data, newname.count);
+    return logMutation(td, tdidx, &rec);
 }
 
 // Add options to a column of type SELECT or TAG
 bool addOptSelectableColumn(Table_Defs td, u32 tdidx, u32 colidx, String_View sv)
 {
     if (UNLIKELY(stbds_arrlen((td).tabs) <= (tdidx))) return false;
-    Table *table = &(td).tabs[(tdidx)];
-    if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) return false;
-    stbds_arrput(table->cols[colidx].opts.strs, sv);
-    return writeTabFile(td.names[tdidx], *table, "./data");
+    Table *table = getTable(td, tdidx);
+    if (UNLIKELY(!applyAddOpt(table, colidx, sv))) return false;
+    Buffer rec = beginWalRecord(table, WAL_OP_ADD_OPT, sizeof(u32) + sizeof(u64) + sv.count);
+    buf_write4(&rec, colidx);
+    buf_writeStr(&rec, sv.data, sv.count);
+    return logMutation(td, tdidx, &rec);
 }
 
 bool renameTable(Table_Defs td, u32 idx, String_View new_name)
 {
     if (UNLIKELY(stbds_arrlen(td.tabs) <= idx)) return false;
+    // The pending records and the checkpoint writer would otherwise be written into the old files after they were renamed
+    flushPersistence(td);
+    finishCheckpoints();
+    collectCheckpoints(td);
     String_View old_name = td.names[idx];
     td.names[idx] = new_name;
     chdir("./data");
-    if (UNLIKELY(!writeDefFile(TD_FILENAME, td, false))) return false;
     char *old_fname = util_memadd(old_name.data, old_name.count, ".tab", 5);
     char *new_fname = util_memadd(new_name.data, new_name.count, ".tab", 5);
-    i32 out = rename(old_fname, new_fname);
+    // In the container, the '.tab' file is renamed by the same commit as tables.def (see writeDefFile)
+    i32 out = 0;
+    if (table_db != NULL && !db_rename(table_db, sv_from_cstr(old_fname), sv_from_cstr(new_fname))) out = -1;
+    if (UNLIKELY(!writeDefFile(TD_FILENAME, td, false))) {
+        free(old_fname);
+        free(new_fname);
+        chdir("..");
+        return false;
+    }
+    if (table_db == NULL) out = rename(old_fname, new_fname);
+    free(old_fname);
+    free(new_fname);
+    // The write-ahead log doesn't exist, if the table was just checkpointed
+    old_fname = util_memadd(old_name.data, old_name.count, ".wal", 5);
+    new_fname = util_memadd(new_name.data, new_name.count, ".wal", 5);
+    if (FileExists(old_fname) && rename(old_fname, new_fname) != 0) out = -1;
+    free(old_fname);
+    free(new_fname);
+    // The old log of a checkpoint only remains, if the checkpoint failed
+    old_fname = getTablePath(NULL, old_name, ".wal.old");
+    new_fname = getTablePath(NULL, new_name, ".wal.old");
+    if (FileExists(old_fname) && rename(old_fname, new_fname) != 0) out = -1;
+    free(old_fname);
+    free(new_fname);
+    // The segment files are stored in a directory named after the table
+    old_fname = getTablePath(NULL, old_name, "");
+    new_fname = getTablePath(NULL, new_name, "");
+    if (table_db == NULL && DirectoryExists(old_fname) && rename(old_fname, new_fname) != 0) out = -1;
     free(old_fname);
     free(new_fname);
     // free(old_name.data);
@@ -326,61 +3294,58 @@ bool renameTable(Table_Defs td, u32 idx, String_View new_name)
 bool addRow(Table_Defs td, u32 tdidx)
 {
     if (UNLIKELY(stbds_arrlen((td).tabs) <= (tdidx))) return false;
-    Table *table = &(td).tabs[(tdidx)];
-    for (i32 i = 0; i < stbds_arrlen(table->cols); i++) {
-        switch (table->cols[i].type)
-        {
-        case TYPE_STR:
-            stbds_arrput(table->vals[i].strs,    (Value_Str){VALUE_DEFAULT_STR});
-            break;
-        case TYPE_SELECT:
-            stbds_arrput(table->vals[i].selects, (Value_Select){VALUE_DEFAULT_SELECT});
-            break;
-        case TYPE_TAG:
-            stbds_arrput(table->vals[i].tags,    (Value_Tag){VALUE_DEFAULT_TAG});
-            break;
-        case TYPE_DATE:
-            stbds_arrput(table->vals[i].dates,   (Value_Date){VALUE_DEFAULT_DATE});
-            break;
-        case TYPE_LEN:
-            PANIC("Can't add values to a column of type 'len'");
-        }
-    }
-    return writeTabFile(td.names[tdidx], *table, "./data");
+    Table *table = getTable(td, tdidx);
+    if (UNLIKELY(!applyAddRow(table))) return false;
+    Buffer rec = beginWalRecord(table, WAL_OP_ADD_ROW, 0);
+    return logMutation(td, tdidx, &rec);
 }
 
 bool setValue(Table_Defs td, u32 tdidx, u32 colidx, u32 rowidx, Value val)
 {
     if (UNLIKELY(stbds_arrlen((td).tabs) <= (tdidx))) return false;
-    Table *table = &(td).tabs[(tdidx)];
-    if (UNLIKELY(stbds_arrlen(table->cols) <= colidx)) return false;
-    Column col  = table->cols[colidx];
-    Values vals = table->vals[colidx];
-    switch (col.type)
+    Table *table = getTable(td, tdidx);
+    if (UNLIKELY(!applySetValue(table, colidx, rowidx, val))) return false;
+    if (table->patchable) stbds_arrput(table->patches, (u64) colidx << 32 | rowidx);
+    Buffer rec = beginWalRecord(table, WAL_OP_SET_VALUE, 64);
+    buf_write4(&rec, colidx);
+    buf_write4(&rec, rowidx);
+    buf_writeValue(&rec, table->cols[colidx].type, val);
+    return logMutation(td, tdidx, &rec);
+}
+
+// Label of the table on the start screen. The amount of rows is taken from the catalog, so that the table doesn't have to be read
+static const char* getTableLabel(Table_Defs td, i32 tdidx)
+{
+    if (tdidx < 0) return "New Table";
+    Table_Info info = getTableInfo(td, tdidx);
+    if (info.rows < 0) return td.names[tdidx].data;
+    return TextFormat("%s (%d rows)", td.names[tdidx].data, info.rows);
+}
+
+// Returns a list of the indexes of all rows, whose value in the column equals the one of the row
+// On TYPE_TAG columns, rows match if they have all (or any, if `any` is true) of its options selected
+static u32* filterByCell(Table *table, u32 colidx, u32 rowidx, bool any)
+{
+    Values vals = *getValues(table, colidx);
+    switch (table->cols[colidx].type)
     {
     case TYPE_STR:
-        if (UNLIKELY(stbds_arrlen(vals.strs) <= rowidx)) return false;
-        vals.strs[rowidx] = val.str;
-        break;
+        return filterStrEq(vals.strs, getStr(vals.strs, rowidx));
     case TYPE_SELECT:
-        if (UNLIKELY(stbds_arrlen(vals.selects) <= rowidx)) return false;
-        vals.selects[rowidx] = val.select;
-        break;
-    case TYPE_TAG:
-        if (UNLIKELY(stbds_arrlen(vals.tags) <= rowidx)) {
-            printf("len: %lld\n", stbds_arrlen(vals.tags));
-            return false;}
-        vals.tags[rowidx] = val.tag;
-        break;
+        return filterSelectEq(table, colidx, getSelect(vals.selects, rowidx));
+    case TYPE_TAG: {
+        Value_Tag tags = NULL;
+        for (i32 k = nextTag(vals.tags, rowidx, -1); k >= 0; k = nextTag(vals.tags, rowidx, k)) stbds_arrput(tags, k);
+        u32 *rows = any ? filterTagsAny(vals.tags, tags) : filterTagsAll(vals.tags, tags);
+        stbds_arrfree(tags);
+        return rows;
+    }
     case TYPE_DATE:
-        if (UNLIKELY(stbds_arrlen(vals.dates) <= rowidx)) return false;
-        vals.dates[rowidx] = val.date;
-        break;
+        return filterDateRange(table, colidx, vals.dates[rowidx], vals.dates[rowidx]);
     case TYPE_LEN:
-        PANIC("Cannot set a value for a column of type 'len'");
+        UNREACHABLE();
     }
-    // table->vals[colidx] = vals;
-    return writeTabFile(td.names[tdidx], *table, "./data");
+    return NULL;
 }
 
 int main(void)
@@ -420,8 +3385,19 @@ int main(void)
     Table_Defs td = { .names = NULL, .tabs = NULL };
     if (!DirectoryExists("./data")) mkdir("./data");
     chdir("./data");
-    if (FileExists(TD_FILENAME)) {
+    if (USE_CONTAINER || FileExists(DB_FILENAME)) {
+        char *cwd     = getcwd(NULL, 0);
+        char *db_path = getTablePath(cwd, sv_from_cstr((char*) DB_FILENAME), "");
+        if (!useContainer(db_path)) PANIC("Couldn't open container '%s'", db_path);
+        free(cwd);
+        free(db_path);
+    }
+    if (hasDefFile(TD_FILENAME)) {
         td = readDefFile(TD_FILENAME);
+        // Catalogs written before version 1 have no metadata, so their tables are read right away to show their sizes
+        bool preload = PRELOAD_TABLES;
+        for (i32 i = 0; i < stbds_arrlen(td.infos); i++) preload |= td.infos[i].rows < 0;
+        if (preload) loadAllTables(td);
         chdir("..");
     } else {
         // @TODO: Only for debugging at the beginning now
@@ -443,6 +3419,8 @@ int main(void)
     }
 
     while (!WindowShouldClose() || IsKeyPressed(KEY_ESCAPE)) {
+        tickPersistence(td);
+        evictTables(td, TABLE_EVICT_AFTER_MS);
         BeginDrawing();
 
         bool isResized = IsWindowResized();
@@ -465,13 +3443,13 @@ int main(void)
             Vector2 mouse     = GetMousePosition();
 
             for (i32 i = -1; i < tables_amount; i++) {
-                char *table_name = i == -1 ? "New Table" : td.names[i].data;
+                const char *table_name = getTableLabel(td, i);
                 text_widths[i+1] = MeasureTextEx(font, table_name, size_default, spacing).x;
                 if (text_widths[i+1] > max_width) max_width = text_widths[i+1];
             }
 
             for (i32 i = -1; i < tables_amount && text_y + size_default + margin < win_height; i++, text_y += size_default + margin + 2*padding) {
-                char *table_name = i == -1 ? "New Table" : td.names[i].data;
+                const char *table_name = getTableLabel(td, i);
                 i32   text_width = text_widths[i+1];
                 Vector2   v      = { .x = (win_width - text_width)/2, .y = text_y + padding };
                 Rectangle r      = { .x = (win_width - max_width)/2 - padding, .y = text_y, .width = max_width + 2*padding, .height = size_default + 2*padding };
@@ -485,8 +3463,8 @@ int main(void)
                             view  = UI_STATE_NEW_TABLE;
                             state.newtable.input = gui_newInputBox("Tablename", false, false, true, gui_newCenteredLabel((Rectangle){.x=0, .y=0, .width=win_width, .height=win_height}, win_width/2, NULL, style_default, style_default));
                         } else {
-                            view = UI_STATE_TABLE;
-                            state.table.tdidx = i;
+                            view  = UI_STATE_TABLE;
+                            state = (UI_State) { .table.tdidx = i };
                         }
                     }
                 }
@@ -517,47 +3495,56 @@ int main(void)
             i32 tdidx = state.table.tdidx;
             DrawTextEx(font, td.names[tdidx].data, (Vector2){ .x = padding, .y = padding }, style_default.font_size, style_default.spacing, style_default.color);
 
-            Table table = td.tabs[tdidx];
-            i32 colslen = stbds_arrlen(table.cols);
+            Table *table = getTable(td, tdidx);
+            i32 colslen  = stbds_arrlen(table->cols);
             i32 x = padding;
+            Vector2 mouse   = GetMousePosition();
+            i32 clicked_col = -1;
+            i32 clicked_row = -1;
             for (i32 i = 0; i <= colslen; i++) {
                 Gui_El_Style style = style_default;
-                char *colname = i == colslen ? "+" : table.cols[i].name.data;
+                char *colname = i == colslen ? "+" : table->cols[i].name.data;
                 i32 name_w    = MeasureTextEx(font, colname, style.font_size, spacing).x;
                 if (i == colslen) {
                     style.bg = GREEN;
                 }
 
                 i32 y = 2*style.pad + style.font_size;
-                gui_drawSized(style, x, y, name_w+2*style.pad, style.font_size+2*style.pad, colname);
-
-                switch (table.cols[i].type)
-                {
-                case TYPE_STR:
-                    for (i32 j = 0; j < stbds_arrlen(table.vals[i].strs); j++) {
-                        y += 2*style.pad + style.font_size + margin;
-                        gui_drawSized(style, x, y, name_w+2*style.pad, style.font_size+2*style.pad, table.vals[i].strs[j].data);
+                i32 w = name_w + 2*style.pad;
+                i32 h = style.font_size + 2*style.pad;
+                gui_drawSized(style, x, y, w, h, colname);
+                if (i == colslen) break;
+
+                // Columns are read from the file once they are displayed for the first time
+                Values vals  = *getValues(table, i);
+                i32    len   = getValuesLen(vals, table->cols[i].type);
+                i32    shown = state.table.filtered ? stbds_arrlen(state.table.rows) : len;
+                for (i32 n = 0; n < shown; n++) {
+                    i32 j = state.table.filtered ? (i32) state.table.rows[n] : n;
+                    y += h + margin;
+                    if (j >= len) continue;
+                    switch (table->cols[i].type)
+                    {
+                    case TYPE_STR: {
+                        // Strings aren't null-terminated
+                        Value_Str sv = getStr(vals.strs, j);
+                        gui_drawSized(style, x, y, w, h, sv.data == NULL ? NULL : TextFormat(SV_Fmt, SV_Arg(sv)));
+                        break;
                     }
-                    break;
 
-                case TYPE_SELECT:
-                    for (i32 j = 0; j < stbds_arrlen(table.vals[i].selects); j++) {
-                        y += 2*style.pad + style.font_size + margin;
-                        Value_Select idx = table.vals[i].selects[j];
+                    case TYPE_SELECT: {
+                        Value_Select idx = getSelect(vals.selects, j);
                         if (idx >= 0) {
-                            String_View val = table.cols[i].opts.strs[idx];
-                            gui_drawSized(style, x, y, name_w+2*style.pad, style.font_size+2*style.pad, val.data);
+                            String_View val = table->cols[i].opts.strs[idx];
+                            gui_drawSized(style, x, y, w, h, val.data);
                         }
+                        break;
                     }
-                    break;
 
-                case TYPE_TAG:
-                    for (i32 j = 0; j < stbds_arrlen(table.vals[i].tags); j++) {
-                        y += 2*style.pad + style.font_size + margin;
-                        Value_Tag tags  = table.vals[i].tags[j];
+                    case TYPE_TAG: {
                         String_View val = sv_from_parts(NULL, 0);
-                        for (i32 k = 0; k < stbds_arrlen(tags); k++) {
-                            String_View s = table.cols[i].opts.strs[tags[k]];
+                        for (i32 k = nextTag(vals.tags, j, -1); k >= 0; k = nextTag(vals.tags, j, k)) {
+                            String_View s = table->cols[i].opts.strs[k];
                             if (val.data == NULL) {
                                 val.data  = malloc(sizeof(char) * (s.count + 1));
                                 memcpy(val.data, s.data, s.count + 1);
@@ -574,25 +3561,47 @@ int main(void)
                                 val.count += 2 + s.count;
                             }
                         }
-                        if (val.data == NULL) DrawRectangle(x, y, name_w+2*style.pad, style.font_size+2*style.pad, style.bg);
-                        else gui_drawSized(style, x, y, name_w+2*style.pad, style.font_size+2*style.pad, val.data);
+                        if (val.data == NULL) DrawRectangle(x, y, w, h, style.bg);
+                        else gui_drawSized(style, x, y, w, h, val.data);
+                        break;
                     }
-                    break;
 
-                case TYPE_DATE:
-                    TODO();
-                    break;
+                    case TYPE_DATE: {
+                        Value_Date date = vals.dates[j];
+                        if (isDateEmpty(date)) DrawRectangle(x, y, w, h, style.bg);
+                        else gui_drawSized(style, x, y, w, h, TextFormat("%d.%d.%d", date.day, date.month, date.year));
+                        break;
+                    }
 
-                case TYPE_LEN:
-                    UNREACHABLE();
+                    case TYPE_LEN:
+                        UNREACHABLE();
+                    }
+                    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && gui_isPointInRec(mouse.x, mouse.y, x, y, w, h)) {
+                        clicked_col = i;
+                        clicked_row = j;
+                    }
                 }
 
-                x += name_w + 2*style.pad + margin;
+                x += w + margin;
+            }
+
+            // Clicking a cell only shows the rows with the same value in its column. Shift matches any of its tags instead of all
+            if (clicked_col >= 0) {
+                bool any = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+                stbds_arrfree(state.table.rows);
+                state.table.rows     = filterByCell(table, clicked_col, clicked_row, any);
+                state.table.filtered = true;
             }
 
             if (IsKeyPressed(KEY_ESCAPE)) {
-                view = UI_STATE_START;
-                state = (UI_State) {0};
+                // The filter is cleared first
+                if (state.table.filtered) {
+                    stbds_arrfree(state.table.rows);
+                    state.table.filtered = false;
+                } else {
+                    view  = UI_STATE_START;
+                    state = (UI_State) {0};
+                }
             }
         }
         }
@@ -600,6 +3609,10 @@ int main(void)
         EndDrawing();
     }
 
+    // Queued checkpoints are written before exiting. Mutations after them are still in the write-ahead logs
+    flushPersistence(td);
+    stopCheckpointWriter();
+    if (table_db != NULL) db_close(table_db);
     CloseWindow();
     return 0;
 }
\ No newline at end of file
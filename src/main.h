@@ -46,24 +46,240 @@ typedef union {
     Value_Date   date;
 } Value;
 
+// All strings of a column are stored back to back in one allocation. Value i is bytes[offs[i]..offs[i+1]]
+// This saves the allocator's overhead for each value and lets the column be read and written in one go
+// Columns with few distinct values can be dictionary-encoded instead: offs and bytes then store each distinct value once
+// and value i is the string with index codes[i]
+typedef struct {
+    u64  *offs;     // Offsets into bytes. NULL if the column doesn't have any values yet
+    char *bytes;    // Content of all strings. Not null-terminated
+    u16  *codes;    // Index into the dictionary for each value. NULL if the column isn't dictionary-encoded
+    i32   len;      // Amount of values
+    i32   dict_len; // Amount of strings in the dictionary
+    bool  owned;    // If false, the arrays point into the mapped file and are copied before being changed
+} Str_Values;
+
+// Values are stored as value+1 (so that -1 becomes 0) with the smallest power of two bits, that fits all options
+// A value therefore never spans two words
+typedef struct {
+    u64  *words; // Packed values
+    i32   len;   // Amount of values
+    u8    bits;  // Bits per value: 1, 2, 4, 8, 16 or 32
+    bool  owned; // If false, words points into the mapped file and is copied before being changed
+} Select_Values;
+
+// Tag columns with few options store each value as a bitmask, where bit i is set if option i is selected
+// Columns with more options than fit into TAG_BITSET_MAX_OPTS bits use the sparse representation instead:
+// the sorted indexes of the selected options of all values are stored back to back. Value i is opts[offs[i]..offs[i+1]]
+typedef struct {
+    u64  *words;         // words_per_row words per value. Unused by the sparse representation
+    u64  *offs;          // Offsets into opts. Only used by the sparse representation. NULL if the column doesn't have any values yet
+    u32  *opts;          // Indexes of the selected options. Only used by the sparse representation
+    i32   len;           // Amount of values
+    u8    words_per_row; // 1, 2 or 4
+    bool  sparse;        // Whether offs and opts are used instead of words
+    bool  owned;         // If false, the arrays point into the mapped file and are copied before being changed
+} Tag_Values;
+
+// How a column's values are stored in the '.tab' file
+typedef enum __attribute__((__packed__)) {
+    ENC_PLAIN,  // See writeValues
+    ENC_DICT,   // Only for TYPE_STR: u64 dict_len, dictionary as in a plain TYPE_STR column, padding to 8 bytes, u16 code per row
+    ENC_VARINT, // For TYPE_STR and sparse TYPE_TAG columns: lengths, counts and options are stored as varints (see writeValues)
+    ENC_RLE,    // Only for TYPE_SELECT: runs of equal values (see writeRunSelects)
+    ENC_DELTA,  // Only for TYPE_DATE: bit-packed differences between consecutive dates (see writeDeltaDates)
+    ENC_SLOT,   // Only for TYPE_STR: fixed-width slots pointing into the file's string heap (see writeSlotStrs)
+    ENC_LEN,    // Amount of elements in this enum
+} Encoding;
+
+// How the column chunks of a '.tab' file are compressed
+typedef enum __attribute__((__packed__)) {
+    COMPRESSION_NONE,
+    COMPRESSION_LZ,   // Chunks, whose size differs from their raw size, are compressed with lz_compress (see lz.h)
+    COMPRESSION_LEN,  // Amount of elements in this enum
+} Compression;
+
+// How the column chunks of a table are stored
+typedef enum __attribute__((__packed__)) {
+    LAYOUT_SINGLE,   // All chunks are stored in the '.tab' file
+    LAYOUT_SEGMENTS, // The '.tab' file is only a manifest and each chunk is stored in its own segment file (see Column_Chunk)
+    LAYOUT_LEN,      // Amount of elements in this enum
+} Layout;
+
 // @Note: Having a union of arrays instead of an array of unions, decreases memory usage,
 // as every element in the array doesn't have to use the maximal size for the union
 typedef union {
-    Value_Str    *strs;
-    Value_Select *selects;
-    Value_Tag    *tags;
+    Str_Values    strs;
+    Select_Values selects;
+    Tag_Values    tags;
     Value_Date   *dates;
 } Values;
 
+// Statistics of the values of a chunk, that let scans skip it without reading it (see scanColumn)
+// Chunks of other types and of files before version 13 get statistics, that never rule anything out
+typedef struct {
+    u64 mask; // TYPE_SELECT: bit v is set if any value is stored as v (value+1 as in Select_Values). Bit 63 stands for all values from 63 on
+    i32 min;  // TYPE_DATE: smallest key (see getDateKey) of a non-empty date
+    i32 max;  // TYPE_DATE: biggest key of a non-empty date. Smaller than min if all dates are empty
+} Chunk_Stats;
+
+// Location of the values of one row group of a column. Row group g contains the rows from g*Table.group_rows on
+// In the segmented layout, each chunk is stored in its own segment file '<table>/<id>.<gen>.col' (with '.<group>' before
+// '.col' for all but the first row group). A changed chunk is written into a new segment file, so that the manifest
+// stays the only file that is replaced
+typedef struct {
+    u64  off;      // Offset from the start of the file. 0 in the segmented layout, as the chunk makes up all of its segment file
+    u64  size;     // Size in bytes
+    u64  raw_size; // Size in bytes before compression. Equal to size if the chunk isn't compressed
+    u64  gen;      // Only used by the segmented layout: lsn of the table when the segment file was written plus one. 0 if there is none
+    i32  rows;     // Amount of values stored in the chunk. Rows added afterwards are filled with default values when loading
+    u32  crc;      // CRC-32C of the chunk, checked before reading it. Only set since version 8
+    Encoding    enc;
+    Chunk_Stats stats;
+} Column_Chunk;
+
+// Where the values of a column are stored
 typedef struct {
-    Column *cols; // List of columns
-    Values *vals; // List of values in Column-Major order, so all values in vals[i] are of the same type
+    Column_Chunk *chunks; // One per row group of the file the values were read from (or of the last segment files written)
+    bool         *dirty;  // Per row group of TAB_GROUP_ROWS rows: whether its values changed since its chunk was written. Missing entries are false
+    bool          loaded; // Whether the values were already read into `Table.vals`
+    u32           id;     // Stable id of the column, that its segment files are named after
+} Column_Block;
+
+// Region at the end of a '.tab' file, that the values of ENC_SLOT columns are stored in
+// Changed values are appended to it by patchTabFile, leaving the old ones behind as garbage until the file is rewritten
+typedef struct {
+    u64  off;     // Offset from the start of the file
+    u64  size;    // Size in bytes
+    u64  garbage; // Bytes that no slot points to anymore
+    u32  crc;     // CRC-32C of the heap
+    bool checked; // Whether the heap of the mapped file was already checked against crc
+} String_Heap;
+
+typedef struct {
+    Column       *cols;     // List of columns
+    Values       *vals;     // List of values in Column-Major order, so all values in vals[i] are of the same type. Should be accessed via getValues
+    Column_Block *blocks;   // Parallel to cols. Columns of mapped tables are only read from the file on first access
+    u32           group_rows; // Rows per row group of the file the table was read from. 0 for files before version 13, which store each column in one chunk
+    i32           rows;     // Amount of rows in the table
+    char         *map;      // Memory-mapped '.tab' file, that the loaded TYPE_STR values point into. NULL if the table wasn't mapped
+    u64           map_size; // Size of the mapping in bytes
+    bool          map_shared; // Whether map points into the mapping of the container (see db_get), which mustn't be unmapped
+    u32           version;  // Format version of the mapped file
+    u32           next_col_id; // Id of the next added column (see Column_Block.id)
+    String_Heap   heap;     // String heap of the mapped file
+    u64           lsn;      // Sequence number of the last mutation applied to the table
+    u64           tab_size; // Size of the '.tab' file in bytes when it was last read or written
+    u64           wal_size; // Size of the table's write-ahead log in bytes
+    u8           *wal_pending;         // Records that weren't appended to the write-ahead log yet (see logMutation)
+    u32           wal_pending_records; // Amount of records in wal_pending
+    u64           wal_pending_since;   // Time in milliseconds (see util_getMillis) when the oldest pending record was added
+    u32           tab_checksum;        // CRC-32C of the '.tab' file when it was last written
+    i64           mtime;               // Seconds since the Unix epoch, when the table was last changed
+    u64           last_access;         // Time in milliseconds when the table was last accessed via getTable
+    bool          loaded;              // Whether the table was read from its files already. Tables are only read once they are accessed
+    bool          patchable;           // Whether all mutations since the '.tab' file was read can be patched into it (see patchTabFile)
+    u64          *patches;             // Cells changed since the '.tab' file was read, as colidx << 32 | rowidx. Only tracked while patchable
 } Table;
 
+// Every mutation of a table is appended to the table's write-ahead log ('<name>.wal') as one record:
+// u32 size (amount of bytes following it), u64 lsn, u8 op, payload
+// Once the log grew big enough, it is checkpointed by rewriting the '.tab' file, which stores the lsn it includes
+typedef enum __attribute__((__packed__)) {
+    WAL_OP_ADD_ROW,       // No payload
+    WAL_OP_SET_VALUE,     // u32 colidx, u32 rowidx, Value
+    WAL_OP_ADD_COLUMN,    // u8 type, String name
+    WAL_OP_RM_COLUMN,     // u32 colidx
+    WAL_OP_RENAME_COLUMN, // u32 colidx, String name
+    WAL_OP_ADD_OPT,       // u32 colidx, String option
+    WAL_OP_LEN,           // Amount of elements in this enum
+} Wal_Op;
+
+typedef enum __attribute__((__packed__)) {
+    LOAD_MODE_COPY, // Every string is copied onto the heap while reading
+    LOAD_MODE_MAP,  // The file is memory-mapped and strings point into the mapping until they are changed
+} Load_Mode;
+
+// Checkpoints are written by a background thread, so that rewriting big tables doesn't make the UI stutter
+// The UI thread hands a snapshot of the table over to the writer and keeps changing the live table meanwhile
+typedef struct {
+    char        *dir;   // Absolute path of the directory containing the table's files
+    String_View  name;  // Copy of the table's name
+    Table        table; // Snapshot of the table, owned by the writer
+} Checkpoint_Job;
+
+typedef struct {
+    String_View   name;     // Name of the checkpointed table
+    u64           tab_size; // Size of the written '.tab' file
+    u32           checksum; // CRC-32C of the written '.tab' file
+    Column_Block *blocks;   // Blocks of the snapshot, with the chunks that were written for them (see applySegments)
+    bool          ok;       // Whether the '.tab' file was written successfully
+} Checkpoint_Result;
+
+typedef struct {
+    util_Thread        thread;
+    util_Mutex         mutex;   // Protects all of the following attributes
+    util_Cond          cond;    // Broadcast whenever a job is queued or finished, or the writer should stop
+    Checkpoint_Job    *jobs;    // Queue of jobs. The first job stays in the queue until it is written
+    Checkpoint_Result *results; // Finished jobs, that the UI thread didn't collect yet
+    bool               started;
+    bool               stop;
+} Checkpoint_Writer;
+
+// Metadata about a table, that is stored in tables.def, so that it is known without reading the table
+typedef struct {
+    i32 rows;     // Amount of rows. -1 if unknown (in catalogs written before version 1)
+    i32 cols;     // Amount of columns. -1 if unknown
+    u64 size;     // Size of the '.tab' file and the write-ahead log in bytes
+    u32 checksum; // CRC-32C of the '.tab' file
+    i64 mtime;    // Seconds since the Unix epoch, when the table was last changed. 0 if unknown
+} Table_Info;
+
+// Tables are loaded by several threads at once. Each thread takes the next table, that no thread started loading yet
+// Tables that are loaded already are skipped
+typedef struct {
+    String_View *names;
+    Table       *tabs;  // Parallel to names. Each table is written by the thread that loaded it
+    Table_Info  *infos; // Parallel to names
+    i32          len;
+    i32          next;  // Index of the next table to load. Protected by mutex
+    util_Mutex   mutex;
+} Table_Loader;
+
+// Work that is split into len parts, which are processed by several threads at once (see runParallel)
+// Each thread takes the next part, that no thread started yet
+typedef struct {
+    void      (*fn)(void *arg, i32 idx);
+    void       *arg;
+    i32         len;
+    i32         next;  // Index of the next part. Protected by mutex
+    util_Mutex  mutex;
+} Parallel_Work;
+
+// Chunks of a table's columns, that are read by several threads at once (see readChunks)
+typedef struct {
+    String_View name;     // Name of the table
+    Table      *table;
+    bool        segments; // Whether the chunks are read from their segment files instead of the mapped file
+    i32        *cols;     // Column of each chunk
+    i32        *groups;   // Row group of each chunk. Parallel to cols
+    Values     *parts;    // Values of each chunk. Parallel to cols
+} Chunk_Reader;
+
+// Rows of a column, that are compared against a value by several threads at once, one row group each (see scanColumn)
+typedef struct {
+    Table  *table;
+    u32     colidx;
+    Value   from;  // TYPE_SELECT: value to find. TYPE_DATE: smallest date to find
+    Value   to;    // TYPE_DATE: biggest date to find
+    u32   **rows;  // Matching rows of each row group
+} Column_Scan;
+
 typedef struct {
     // The attributes are parralel arrays
     Table       *tabs;
     String_View *names;
+    Table_Info  *infos; // Metadata as of the last time tables.def was written. Should be accessed via getTableInfo
 } Table_Defs;
 
 typedef enum __attribute__((__packed__)) {
@@ -74,9 +290,11 @@ typedef enum __attribute__((__packed__)) {
 
 typedef union {
     struct {
-        u32 tdidx;
-        u32 colidx;
-        u32 rowidx;
+        u32  tdidx;
+        u32  colidx;
+        u32  rowidx;
+        bool filtered;
+        u32 *rows;     // Indexes of the rows shown while filtered (see filterByCell)
     } table;
     struct {
         Gui_Input_Box input;
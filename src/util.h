@@ -7,10 +7,25 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h> // For malloc
+#include <limits.h> // For INT_MAX
 #include <fcntl.h>
 #include <io.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#endif
+
+// Only Windows distinguishes between text and binary files
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Most bytes passed to one call of read or write. On Windows, they take an unsigned int and return an int
+#define UTIL_IO_MAX INT_MAX
 
 ////////////
 // Macros //
@@ -59,6 +74,27 @@
 #define STATIC_ASSERT(expr) STATIC_ASSERT_MSG(expr, #expr);
 
 
+///////////
+// Types //
+///////////
+
+#if defined(_WIN32)
+typedef void* util_Thread;
+typedef struct { void *ptr; } util_Mutex; // Same layout as SRWLOCK
+typedef struct { void *ptr; } util_Cond;  // Same layout as CONDITION_VARIABLE
+#else
+typedef pthread_t       util_Thread;
+typedef pthread_mutex_t util_Mutex;
+typedef pthread_cond_t  util_Cond;
+#endif
+
+// Piece of memory, that is written by util_writeFileV right from where it is
+typedef struct {
+    const void *data;
+    u64         size;
+} util_Slice;
+
+
 //////////////////
 // Declarations //
 //////////////////
@@ -66,6 +102,26 @@
 void* util_memadd(const void *a, u64 a_size, const void *b, u64 b_size);
 char* util_readFile(const char *fpath, u64 *size);
 bool  util_writeFile(const char *fpath, char *buf, u64 size);
+bool  util_appendFile(const char *fpath, char *buf, u64 size);
+bool  util_writeFileV(const char *fpath, const util_Slice *slices, u64 len);
+char* util_mapFile(const char *fpath, u64 *size);
+void  util_unmapFile(char *data, u64 size);
+bool  util_replaceFile(const char *src, const char *dst);
+bool  util_readAt(int fd, u64 off, void *buf, u64 size);
+bool  util_writeAt(int fd, u64 off, const void *buf, u64 size);
+bool  util_syncFile(int fd);
+bool  util_startThread(util_Thread *thread, void (*fn)(void*), void *arg);
+void  util_joinThread(util_Thread thread);
+void  util_initMutex(util_Mutex *mutex);
+void  util_lockMutex(util_Mutex *mutex);
+void  util_unlockMutex(util_Mutex *mutex);
+void  util_initCond(util_Cond *cond);
+void  util_waitCond(util_Cond *cond, util_Mutex *mutex);
+void  util_broadcastCond(util_Cond *cond);
+u64   util_getMillis(void);
+u32   util_getCoreCount(void);
+u32   util_crc32c(u32 crc, const void *data, u64 size);
+u32   util_crc32cCombine(u32 crc_a, u32 crc_b, u64 size_b);
 
 
 #endif // UTIL_H_
@@ -79,7 +135,7 @@ bool  util_writeFile(const char *fpath, char *buf, u64 size);
 // a_size and b_size should both be the size in bytes, not the count of elements
 void* util_memadd(const void *a, u64 a_size, const void *b, u64 b_size)
 {
-	char* out = malloc(a_size * b_size);
+	char* out = malloc(a_size + b_size);
 	memcpy(out, a, a_size);
 	memcpy(&out[a_size], b, b_size);
 	return (void*) out;
@@ -90,14 +146,19 @@ char* util_readFile(const char *fpath, u64 *size)
     // Adapted from https://stackoverflow.com/a/68156485/13764271
     char* out = NULL;
     *size = 0;
-    int fd = open(fpath, O_RDONLY, 0777);
+    int fd = open(fpath, O_RDONLY | O_BINARY, 0777);
     if (fd == -1) goto end;
     struct stat sb;
-    if (stat(fpath, &sb) == -1) goto fd_end;
+    if (fstat(fd, &sb) == -1) goto fd_end;
     if (sb.st_size == 0) goto fd_end;
     out = malloc(sb.st_size);
     if (out == NULL) goto fd_end;
-    if (read(fd, out, sb.st_size) == -1) goto fd_end;
+    // read might return less than requested, so it is repeated until the whole file was read
+    if (!util_readAt(fd, 0, out, sb.st_size)) {
+        free(out);
+        out = NULL;
+        goto fd_end;
+    }
     *size = (u64) sb.st_size;
 fd_end:
     close(fd);
@@ -108,11 +169,32 @@ end:
 bool util_writeFile(const char *fpath, char *buf, u64 size)
 {
     bool out = false;
-    int fd = open(fpath, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    int fd = open(fpath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0777);
+    if (fd == -1) goto end;
+    u64 written = 0;
+    while (written < size) {
+        u64 left = size - written;
+        int res  = write(fd, &buf[written], MIN(left, UTIL_IO_MAX));
+        if (res == -1) goto fd_end;
+        written += res;
+    }
+    out = true;
+fd_end:
+    close(fd);
+end:
+    return out;
+}
+
+// Same as util_writeFile, except that buf is appended to the file instead of replacing its content
+bool util_appendFile(const char *fpath, char *buf, u64 size)
+{
+    bool out = false;
+    int fd = open(fpath, O_WRONLY | O_CREAT | O_APPEND | O_BINARY, 0777);
     if (fd == -1) goto end;
     u64 written = 0;
     while (written < size) {
-        int res = write(fd, &buf[written], size - written);
+        u64 left = size - written;
+        int res  = write(fd, &buf[written], MIN(left, UTIL_IO_MAX));
         if (res == -1) goto fd_end;
         written += res;
     }
@@ -123,5 +205,395 @@ end:
     return out;
 }
 
+// Same as util_writeFile, except that the content is made up of the slices, which are written one after another
+// without copying them into one buffer first. Uses writev, which writes up to UTIL_IOV_MAX slices per call
+#define UTIL_IOV_MAX 1024
+bool util_writeFileV(const char *fpath, const util_Slice *slices, u64 len)
+{
+    bool out = false;
+    int fd = open(fpath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0777);
+    if (fd == -1) goto end;
+#if defined(_WIN32)
+    // Windows has no writev, so each slice is written on its own
+    for (u64 i = 0; i < len; i++) {
+        u64 written = 0;
+        while (written < slices[i].size) {
+            u64 left = slices[i].size - written;
+            int res  = write(fd, &((const char*)slices[i].data)[written], MIN(left, UTIL_IO_MAX));
+            if (res == -1) goto fd_end;
+            written += res;
+        }
+    }
+#else
+    struct iovec iov[UTIL_IOV_MAX];
+    u64 done = 0; // Bytes of slices[i] that were written already
+    for (u64 i = 0; i < len;) {
+        int count = 0;
+        for (u64 k = i; k < len && count < UTIL_IOV_MAX; k++, count++) {
+            u64 skip = k == i ? done : 0;
+            iov[count] = (struct iovec) { .iov_base = (char*) slices[k].data + skip, .iov_len = slices[k].size - skip };
+        }
+        ssize_t res = writev(fd, iov, count);
+        if (res == -1) goto fd_end;
+        // Partial writes continue right after the last written byte
+        u64 left = (u64) res;
+        while (i < len && left >= slices[i].size - done) {
+            left -= slices[i].size - done;
+            done  = 0;
+            i++;
+        }
+        done += left;
+    }
+#endif
+    out = true;
+fd_end:
+    close(fd);
+end:
+    return out;
+}
+
+#if defined(_WIN32)
+// Declared by hand, since including windows.h clashes with raylib's names (Rectangle, CloseWindow, ...)
+__declspec(dllimport) intptr_t __stdcall _get_osfhandle(int fd);
+__declspec(dllimport) void*    __stdcall CreateFileMappingA(void *file, void *attrs, unsigned long protect, unsigned long size_hi, unsigned long size_lo, const char *name);
+__declspec(dllimport) void*    __stdcall MapViewOfFile(void *mapping, unsigned long access, unsigned long off_hi, unsigned long off_lo, size_t size);
+__declspec(dllimport) int      __stdcall UnmapViewOfFile(const void *addr);
+__declspec(dllimport) int      __stdcall CloseHandle(void *handle);
+__declspec(dllimport) int      __stdcall MoveFileExA(const char *src, const char *dst, unsigned long flags);
+__declspec(dllimport) void*    __stdcall CreateThread(void *attrs, size_t stack_size, unsigned long (__stdcall *fn)(void*), void *arg, unsigned long flags, unsigned long *id);
+__declspec(dllimport) unsigned long __stdcall WaitForSingleObject(void *handle, unsigned long ms);
+__declspec(dllimport) void     __stdcall InitializeSRWLock(util_Mutex *lock);
+__declspec(dllimport) void     __stdcall AcquireSRWLockExclusive(util_Mutex *lock);
+__declspec(dllimport) void     __stdcall ReleaseSRWLockExclusive(util_Mutex *lock);
+__declspec(dllimport) void     __stdcall InitializeConditionVariable(util_Cond *cond);
+__declspec(dllimport) int      __stdcall SleepConditionVariableSRW(util_Cond *cond, util_Mutex *lock, unsigned long ms, unsigned long flags);
+__declspec(dllimport) void     __stdcall WakeAllConditionVariable(util_Cond *cond);
+__declspec(dllimport) unsigned long long __stdcall GetTickCount64(void);
+__declspec(dllimport) unsigned long __stdcall GetActiveProcessorCount(unsigned short group);
+#define UTIL_PAGE_READONLY            0x02
+#define UTIL_FILE_MAP_READ            0x04
+#define UTIL_MOVEFILE_REPLACE_EXISTING 0x01
+#define UTIL_INFINITE                 0xFFFFFFFF
+#define UTIL_ALL_PROCESSOR_GROUPS     0xFFFF
+#endif
+
+// Maps the whole file read-only into memory. Returns NULL if the file doesn't exist or is empty
+// The mapping stays valid after the file was replaced via util_replaceFile (but not if it was truncated in place)
+char* util_mapFile(const char *fpath, u64 *size)
+{
+    char* out = NULL;
+    *size = 0;
+    int fd = open(fpath, O_RDONLY, 0777);
+    if (fd == -1) goto end;
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) goto fd_end;
+    if (sb.st_size == 0) goto fd_end;
+#if defined(_WIN32)
+    void *mapping = CreateFileMappingA((void*) _get_osfhandle(fd), NULL, UTIL_PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) goto fd_end;
+    out = MapViewOfFile(mapping, UTIL_FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // The view keeps the mapping alive
+#else
+    out = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (out == MAP_FAILED) out = NULL;
+#endif
+    if (out != NULL) *size = (u64) sb.st_size;
+fd_end:
+    close(fd);
+end:
+    return out;
+}
+
+void util_unmapFile(char *data, u64 size)
+{
+    if (data == NULL) return;
+#if defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// Reads exactly size bytes starting at offset off of the open file
+bool util_readAt(int fd, u64 off, void *buf, u64 size)
+{
+    u64 done = 0;
+    while (done < size) {
+#if defined(_WIN32)
+        if (_lseeki64(fd, off + done, SEEK_SET) == -1) return false;
+        u64 left = size - done;
+        int res  = read(fd, &((char*)buf)[done], MIN(left, UTIL_IO_MAX));
+#else
+        ssize_t res = pread(fd, &((char*)buf)[done], size - done, off + done);
+#endif
+        if (res <= 0) return false;
+        done += res;
+    }
+    return true;
+}
+
+// Writes size bytes at offset off of the open file, growing the file if needed
+bool util_writeAt(int fd, u64 off, const void *buf, u64 size)
+{
+    u64 done = 0;
+    while (done < size) {
+#if defined(_WIN32)
+        if (_lseeki64(fd, off + done, SEEK_SET) == -1) return false;
+        u64 left = size - done;
+        int res  = write(fd, &((const char*)buf)[done], MIN(left, UTIL_IO_MAX));
+#else
+        ssize_t res = pwrite(fd, &((const char*)buf)[done], size - done, off + done);
+#endif
+        if (res <= 0) return false;
+        done += res;
+    }
+    return true;
+}
+
+// Makes sure everything written to the file reached the disk
+bool util_syncFile(int fd)
+{
+#if defined(_WIN32)
+    return _commit(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+// Atomically replaces dst with src (overwriting dst if it exists already)
+bool util_replaceFile(const char *src, const char *dst)
+{
+#if defined(_WIN32)
+    return MoveFileExA(src, dst, UTIL_MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(src, dst) == 0;
+#endif
+}
+
+typedef struct {
+    void (*fn)(void*);
+    void  *arg;
+} util__Thread_Start;
+
+#if defined(_WIN32)
+static unsigned long __stdcall util__runThread(void *arg)
+#else
+static void* util__runThread(void *arg)
+#endif
+{
+    util__Thread_Start start = *(util__Thread_Start*) arg;
+    free(arg);
+    start.fn(start.arg);
+    return 0;
+}
+
+// Runs fn(arg) on a new thread. Returns false if the thread couldn't be created
+bool util_startThread(util_Thread *thread, void (*fn)(void*), void *arg)
+{
+    util__Thread_Start *start = malloc(sizeof(util__Thread_Start));
+    start->fn  = fn;
+    start->arg = arg;
+#if defined(_WIN32)
+    *thread = CreateThread(NULL, 0, util__runThread, start, 0, NULL);
+    bool out = *thread != NULL;
+#else
+    bool out = pthread_create(thread, NULL, util__runThread, start) == 0;
+#endif
+    if (!out) free(start);
+    return out;
+}
+
+// Waits until the thread finished
+void util_joinThread(util_Thread thread)
+{
+#if defined(_WIN32)
+    WaitForSingleObject(thread, UTIL_INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+void util_initMutex(util_Mutex *mutex)
+{
+#if defined(_WIN32)
+    InitializeSRWLock(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void util_lockMutex(util_Mutex *mutex)
+{
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void util_unlockMutex(util_Mutex *mutex)
+{
+#if defined(_WIN32)
+    ReleaseSRWLockExclusive(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+void util_initCond(util_Cond *cond)
+{
+#if defined(_WIN32)
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+// Unlocks the mutex while waiting for the condition to be signaled. The mutex is locked again afterwards
+// Waking up doesn't guarantee that the condition the caller waits for is true, so this should be called in a loop
+void util_waitCond(util_Cond *cond, util_Mutex *mutex)
+{
+#if defined(_WIN32)
+    SleepConditionVariableSRW(cond, mutex, UTIL_INFINITE, 0);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void util_broadcastCond(util_Cond *cond)
+{
+#if defined(_WIN32)
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+// Milliseconds since an arbitrary point in time. Only useful for measuring durations
+u64 util_getMillis(void)
+{
+#if defined(_WIN32)
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+// Amount of logical processors available. At least 1
+u32 util_getCoreCount(void)
+{
+#if defined(_WIN32)
+    long count = GetActiveProcessorCount(UTIL_ALL_PROCESSOR_GROUPS);
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count < 1 ? 1 : (u32) count;
+}
+
+// Tables for computing CRC-32C eight bytes at a time (slicing-by-8), if the CPU has no CRC instructions
+// util__crc32c_table[k][b] is the CRC of byte b followed by k zero bytes
+static u32  util__crc32c_table[8][256];
+static bool util__crc32c_hw;
+static u32  util__crc32c_x2n[64]; // x^(2^n) modulo the CRC polynomial, for combining checksums
+
+// Product of two polynomials modulo the CRC polynomial, in the reflected bit order of the checksums
+static u32 util__crc32cMultiply(u32 a, u32 b)
+{
+    u32 m = 1u << 31;
+    u32 p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ 0x82F63B78 : b >> 1;
+    }
+    return p;
+}
+
+// Runs before main, so that the tables never have to be initialized concurrently by several threads
+__attribute__((constructor)) static void util__initCrc32c(void)
+{
+    for (u32 b = 0; b < 256; b++) {
+        u32 crc = b;
+        for (u32 k = 0; k < 8; k++) crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        util__crc32c_table[0][b] = crc;
+    }
+    for (u32 b = 0; b < 256; b++) {
+        for (u32 k = 1; k < 8; k++) {
+            u32 prev = util__crc32c_table[k - 1][b];
+            util__crc32c_table[k][b] = (prev >> 8) ^ util__crc32c_table[0][prev & 0xFF];
+        }
+    }
+    u32 p = 1u << 30; // x^1
+    for (u32 n = 0; n < 64; n++) {
+        util__crc32c_x2n[n] = p;
+        p = util__crc32cMultiply(p, p);
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    util__crc32c_hw = __builtin_cpu_supports("sse4.2");
+#elif defined(__ARM_FEATURE_CRC32)
+    util__crc32c_hw = true;
+#endif
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static u32 util__crc32cHw(u32 crc, const u8 *bytes, u64 size)
+{
+    u64 c = crc;
+    for (; size > 0 && ((uintptr_t) bytes % sizeof(u64)) != 0; size--) c = __builtin_ia32_crc32qi(c, *bytes++);
+    for (; size >= sizeof(u64); size -= sizeof(u64), bytes += sizeof(u64)) c = __builtin_ia32_crc32di(c, *((const u64*) bytes));
+    for (; size > 0; size--) c = __builtin_ia32_crc32qi(c, *bytes++);
+    return c;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static u32 util__crc32cHw(u32 crc, const u8 *bytes, u64 size)
+{
+    for (; size > 0 && ((uintptr_t) bytes % sizeof(u64)) != 0; size--) crc = __builtin_arm_crc32cb(crc, *bytes++);
+    for (; size >= sizeof(u64); size -= sizeof(u64), bytes += sizeof(u64)) crc = __builtin_arm_crc32cd(crc, *((const u64*) bytes));
+    for (; size > 0; size--) crc = __builtin_arm_crc32cb(crc, *bytes++);
+    return crc;
+}
+#endif
+
+// CRC-32C (Castagnoli) of the data. To checksum data in several parts, pass the result for the previous parts as crc (0 for the first part)
+// Uses the CRC instructions of SSE4.2 or ARMv8 if available
+u32 util_crc32c(u32 crc, const void *data, u64 size)
+{
+    const u8 *bytes = data;
+    crc = ~crc;
+#if defined(__x86_64__) || defined(__ARM_FEATURE_CRC32)
+    if (LIKELY(util__crc32c_hw)) return ~util__crc32cHw(crc, bytes, size);
+#endif
+    for (; size >= sizeof(u64); size -= sizeof(u64), bytes += sizeof(u64)) {
+        // Assumes a little-endian machine like the rest of the storage code
+        u64 word = *((const u64*) bytes) ^ crc;
+        crc = util__crc32c_table[7][ word        & 0xFF] ^ util__crc32c_table[6][(word >>  8) & 0xFF] ^
+              util__crc32c_table[5][(word >> 16) & 0xFF] ^ util__crc32c_table[4][(word >> 24) & 0xFF] ^
+              util__crc32c_table[3][(word >> 32) & 0xFF] ^ util__crc32c_table[2][(word >> 40) & 0xFF] ^
+              util__crc32c_table[1][(word >> 48) & 0xFF] ^ util__crc32c_table[0][ word >> 56        ];
+    }
+    for (; size > 0; size--) crc = (crc >> 8) ^ util__crc32c_table[0][(crc ^ *bytes++) & 0xFF];
+    return ~crc;
+}
+
+// CRC-32C of the data A followed by the data B, given the checksums of both and the size of B in bytes
+// Takes O(log size_b) time, so checksums of large files can be updated without reading them again
+u32 util_crc32cCombine(u32 crc_a, u32 crc_b, u64 size_b)
+{
+    // Appending size_b bytes multiplies crc_a by x^(8*size_b)
+    u32 shift = 1u << 31; // x^0
+    for (u32 n = 3; size_b != 0; size_b >>= 1, n++) {
+        if (size_b & 1) shift = util__crc32cMultiply(util__crc32c_x2n[n % 64], shift);
+    }
+    return util__crc32cMultiply(shift, crc_a) ^ crc_b;
+}
+
 #endif // UTIL_IMPL_GUARD_
 #endif // UTIL_IMPLEMENTATION